@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "calcgraph.h"
+
+using intpair = std::pair<int, int>;
+using p_intpair = std::shared_ptr<intpair>;
+
+static int int_increment(int a) { return a + 1; }
+
+/**
+ * @brief The time taken to append a value to the head of a chain of nodes and
+ * evaluate the whole chain, for each propagation policy.
+ * @details Arg is the length of the chain.
+ */
+template <template <typename> class PROPAGATE>
+static void BM_Chain(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto head = g.node().propagate<PROPAGATE>().connect(
+        int_increment, calcgraph::unconnected<int>());
+    std::vector<decltype(head)> chain{head};
+    for (int i = 1; i < state.range(0); ++i) {
+        chain.push_back(g.node().propagate<PROPAGATE>().connect(
+            int_increment, chain.back().get()));
+    }
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        head->template input<0>().append(g, ++i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_Chain, calcgraph::Always)->Range(1, 256);
+BENCHMARK_TEMPLATE(BM_Chain, calcgraph::OnChange)->Range(1, 256);
+BENCHMARK_TEMPLATE(BM_Chain, calcgraph::Weak)->Range(1, 256);
+
+/**
+ * @brief As BM_Chain, but with the whole chain fused into a single Node with
+ * NodeBuilder::pipe
+ * @details Arg is the length of the chain; only a few lengths are
+ * instantiated as the chain's built at compile time.
+ */
+template <std::size_t N>
+struct PipeChain {
+    template <typename BUILDER>
+    static auto build(BUILDER builder) {
+        return PipeChain<N - 1>::build(builder.pipe(int_increment));
+    }
+};
+template <>
+struct PipeChain<0> {
+    template <typename BUILDER>
+    static auto build(BUILDER builder) {
+        return builder.connect(calcgraph::unconnected<int>());
+    }
+};
+
+template <std::size_t N>
+static void BM_Pipe(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node = PipeChain<N - 1>::build(g.node().pipe(int_increment));
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        node->template input<0>().append(g, ++i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+}
+BENCHMARK_TEMPLATE(BM_Pipe, 1);
+BENCHMARK_TEMPLATE(BM_Pipe, 8);
+BENCHMARK_TEMPLATE(BM_Pipe, 64);
+
+/**
+ * @brief The distribution of append-to-evaluated latencies through a chain
+ * of nodes
+ * @details Reports the 50th, 99th and 99.9th percentile latencies as counters.
+ * Arg is the length of the chain.
+ */
+static void BM_ChainLatency(benchmark::State &state) {
+    calcgraph::Graph g;
+    calcgraph::Latest<int> res;
+    auto head = g.node().connect(int_increment, calcgraph::unconnected<int>());
+    std::vector<decltype(head)> chain{head};
+    for (int i = 1; i < state.range(0); ++i) {
+        chain.push_back(g.node().connect(int_increment, chain.back().get()));
+    }
+    chain.back()->connect(res);
+    g();
+
+    std::vector<double> samples;
+    samples.reserve(state.max_iterations);
+    int i = 0;
+    for (auto _ : state) {
+        auto start = std::chrono::steady_clock::now();
+        head->input<0>().append(g, ++i);
+        g();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(
+            std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    benchmark::DoNotOptimize(res.read());
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        return samples[static_cast<std::size_t>(p * (samples.size() - 1))];
+    };
+    state.counters["p50_ns"] = percentile(0.5);
+    state.counters["p99_ns"] = percentile(0.99);
+    state.counters["p999_ns"] = percentile(0.999);
+}
+BENCHMARK(BM_ChainLatency)->Arg(1)->Arg(16)->Arg(256);
+
+/**
+ * @brief One node with many dependents
+ * @details Arg is the number of dependents.
+ */
+static void BM_FanOut(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto head = g.node().connect(int_increment, calcgraph::unconnected<int>());
+    std::vector<decltype(head)> leaves;
+    for (int i = 0; i < state.range(0); ++i) {
+        leaves.push_back(g.node().connect(int_increment, head.get()));
+    }
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        head->input<0>().append(g, ++i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * (state.range(0) + 1));
+}
+BENCHMARK(BM_FanOut)->Range(1, 1024);
+
+/**
+ * @brief As BM_FanOut, but with the dependents built before the head, so
+ * they're put on the Graph's work_queue for the next evaluation rather than
+ * onto the heap
+ */
+static void BM_FanOutNextEvaluation(benchmark::State &state) {
+    calcgraph::Graph g;
+    using node_type = decltype(
+        g.node().connect(int_increment, calcgraph::unconnected<int>()));
+    std::vector<node_type> leaves;
+    for (int i = 0; i < state.range(0); ++i) {
+        leaves.push_back(
+            g.node().connect(int_increment, calcgraph::unconnected<int>()));
+    }
+    auto head = g.node().connect(int_increment, calcgraph::unconnected<int>());
+    for (auto &leaf : leaves) {
+        head->connect(leaf->input<0>());
+    }
+    while (g()) {
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        head->input<0>().append(g, ++i);
+        g();
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * (state.range(0) + 1));
+}
+BENCHMARK(BM_FanOutNextEvaluation)->Range(1, 1024);
+
+/**
+ * @brief One node with many Variadic inputs, only one of which changes each
+ * evaluation
+ * @details Arg is the number of inputs.
+ */
+static void BM_FanInVariadic(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node = g.node().variadic<int>().connect(
+        [](std::shared_ptr<std::vector<int>> vals) {
+            int sum = 0;
+            for (int v : *vals)
+                sum += v;
+            return sum;
+        });
+    std::vector<calcgraph::Input<int>> inputs;
+    for (int i = 0; i < state.range(0); ++i) {
+        inputs.push_back(node->variadic_add<0>());
+    }
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        inputs[i % inputs.size()].append(g, i);
+        ++i;
+        g();
+    }
+}
+BENCHMARK(BM_FanInVariadic)->Range(1, 1024);
+
+/**
+ * @brief As BM_FanInVariadic, but with an Incremental input policy and a
+ * function that only looks at the changed inputs
+ */
+static void BM_FanInIncremental(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node = g.node().incremental<int>().connect(
+        [](std::shared_ptr<const calcgraph::Changes<int>> c) {
+            int sum = 0;
+            for (auto idx : c->changed)
+                sum += c->values[idx];
+            return sum;
+        });
+    std::vector<calcgraph::Input<int>> inputs;
+    for (int i = 0; i < state.range(0); ++i) {
+        inputs.push_back(node->variadic_add<0>());
+    }
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        inputs[i % inputs.size()].append(g, i);
+        ++i;
+        g();
+    }
+}
+BENCHMARK(BM_FanInIncremental)->Range(1, 1024);
+
+/**
+ * @brief Summing the vector a Variadic input passes to its function, with
+ * std::accumulate or reduce::sum
+ * @details Arg is the number of values.
+ */
+template <bool REDUCE>
+static void BM_VariadicSum(benchmark::State &state) {
+    std::vector<double> vals(state.range(0), 1.5);
+    for (auto _ : state) {
+        double total = REDUCE ? calcgraph::reduce::sum(vals)
+                              : std::accumulate(vals.begin(), vals.end(), 0.0);
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_VariadicSum, false)->Range(8, 4096);
+BENCHMARK_TEMPLATE(BM_VariadicSum, true)->Range(8, 4096);
+
+/**
+ * @brief Append a batch of values to an Accumulate input, then evaluate
+ * @details Arg is the number of values per batch.
+ */
+static void BM_Accumulate(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node = g.node()
+                    .accumulate(calcgraph::unconnected<int>())
+                    .connect([](std::shared_ptr<std::forward_list<int>> vals) {
+                        int sum = 0;
+                        for (int v : *vals)
+                            sum += v;
+                        return sum;
+                    });
+    g();
+
+    for (auto _ : state) {
+        for (int i = 0; i < state.range(0); ++i)
+            node->input<0>().append(g, i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Accumulate)->Range(1, 256);
+
+/**
+ * @brief As BM_Accumulate, but with a Batched input policy
+ */
+static void BM_Batched(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node =
+        g.node()
+            .batched(calcgraph::unconnected<int>())
+            .connect([](std::shared_ptr<const std::vector<int>> vals) {
+                int sum = 0;
+                for (int v : *vals)
+                    sum += v;
+                return sum;
+            });
+    g();
+
+    for (auto _ : state) {
+        for (int i = 0; i < state.range(0); ++i)
+            node->input<0>().append(g, i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Batched)->Range(1, 256);
+
+/**
+ * @brief As BM_Batched, but passing each batch to Input::append_many so the
+ * node's only scheduled once per batch
+ */
+static void BM_BatchedAppendMany(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node =
+        g.node()
+            .batched(calcgraph::unconnected<int>())
+            .connect([](std::shared_ptr<const std::vector<int>> vals) {
+                int sum = 0;
+                for (int v : *vals)
+                    sum += v;
+                return sum;
+            });
+    g();
+
+    std::vector<int> batch(state.range(0));
+    for (auto _ : state) {
+        node->input<0>().append_many(g, batch.begin(), batch.end());
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BatchedAppendMany)->Range(1, 256);
+
+/**
+ * @brief As BM_Accumulate, but with a Ring input policy big enough to hold
+ * every batch
+ */
+static void BM_Ring(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto node = g.node()
+                    .ring<int, 256>(calcgraph::unconnected<int>())
+                    .connect([](calcgraph::View<int> vals) {
+                        int sum = 0;
+                        for (int v : vals)
+                            sum += v;
+                        return sum;
+                    });
+    g();
+
+    for (auto _ : state) {
+        for (int i = 0; i < state.range(0); ++i)
+            node->input<0>().append(g, i);
+        g();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Ring)->Range(1, 256);
+
+/**
+ * @brief A Demultiplexed node with many keyed outputs, each connected to its
+ * own downstream node
+ * @details Arg is the number of keys.
+ */
+static void BM_Demultiplexed(benchmark::State &state) {
+    calcgraph::Graph g;
+    auto demux = g.node()
+                     .output<calcgraph::Demultiplexed>()
+                     .latest(calcgraph::unconnected<p_intpair>())
+                     .connect([](p_intpair a) { return a ? *a : intpair(); });
+    auto first = demux->keyed_output(0);
+    auto leaf = g.node().connect(int_increment, &first);
+    std::vector<decltype(leaf)> leaves{leaf};
+    for (int k = 1; k < state.range(0); ++k) {
+        auto keyed = demux->keyed_output(k);
+        leaves.push_back(g.node().connect(int_increment, &keyed));
+    }
+    g();
+
+    int i = 0;
+    for (auto _ : state) {
+        demux->input<0>().append(
+            g, std::make_shared<intpair>(i % state.range(0), i));
+        ++i;
+        g();
+    }
+}
+BENCHMARK(BM_Demultiplexed)->Range(1, 4096);
+
+#ifdef __linux__
+/**
+ * @brief Feeding a recorded log of values into a Node with Replay::run
+ * @details Arg is the batch size passed to run.
+ */
+static void BM_Replay(benchmark::State &state) {
+    char path[] = "/tmp/calcgraph-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        state.SkipWithError("couldn't create the log");
+        return;
+    }
+    close(fd);
+
+    const int records = 1 << 16;
+    calcgraph::Graph g;
+    auto node = g.node().connect(int_increment, calcgraph::unconnected<int>());
+    {
+        calcgraph::Recorder rec;
+        rec.open(path, records * 32);
+        auto in = rec.record(0, node->input<0>());
+        for (int i = 0; i < records; ++i)
+            in.append(g, i);
+    }
+    g();
+
+    calcgraph::Replay replay;
+    replay.open(path);
+    replay.replay(0, node->input<0>());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(replay.run(g, state.range(0)));
+    }
+    state.SetItemsProcessed(state.iterations() * records);
+    unlink(path);
+}
+BENCHMARK(BM_Replay)->Arg(1)->Arg(64);
+#endif
+
+/**
+ * @brief Many threads appending to (and so scheduling) nodes on the same
+ * Graph, while the first thread also evaluates it
+ * @details Measures contention on the Graph's work_queue in Work::schedule.
+ */
+static void BM_ScheduleContention(benchmark::State &state) {
+    using node_type = decltype(calcgraph::Graph().node().connect(
+        int_increment, calcgraph::unconnected<int>()));
+    static calcgraph::Graph *g;
+    static std::vector<node_type> sources;
+
+    if (state.thread_index() == 0) {
+        g = new calcgraph::Graph();
+        for (int t = 0; t < state.threads(); ++t) {
+            sources.push_back(g->node().connect(
+                int_increment, calcgraph::unconnected<int>()));
+        }
+    }
+
+    int i = 0;
+    for (auto _ : state) {
+        sources[state.thread_index()]->input<0>().append(*g, ++i);
+        if (state.thread_index() == 0)
+            (*g)();
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0) {
+        sources.clear();
+        delete g;
+    }
+}
+BENCHMARK(BM_ScheduleContention)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
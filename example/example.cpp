@@ -1,10 +1,16 @@
 #include <thread>
 #include <gsl/gsl_multifit.h>
+#include <algorithm>
 #include <cmath>
 #include <csignal>
 #include <cstdint>
+#include <cstdlib>
+#include <ctime>
 #include <iostream>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <netinet/ip.h>
 #include <unordered_map>
 #include <set>
@@ -47,8 +53,6 @@ using uint8_vector = std::shared_ptr<std::vector<uint8_t>>;
 using double_vector = std::shared_ptr<std::vector<double>>;
 using uint8double_vector =
     std::shared_ptr<std::vector<std::pair<uint8_t, double>>>;
-using string = std::shared_ptr<std::string>;
-using strings = std::shared_ptr<std::forward_list<string>>;
 using order = std::shared_ptr<Order>;
 
 /**
@@ -71,6 +75,30 @@ static std::atomic<bool> stop(false);
  */
 static const int buffer_len = 4096;
 
+/**
+ * @brief The most datagrams to read with a single recvmmsg call
+ */
+static const unsigned int recv_batch = 64;
+
+/**
+ * @brief A received UDP datagram
+ * @details Allocated from a calcgraph::Pool, so once the pool's warmed up
+ * receiving a datagram doesn't call malloc. The payload is always followed by
+ * a NUL byte so it can be parsed in place.
+ */
+struct Datagram final {
+    /**
+     * @brief When the kernel received the datagram, or zero if the socket
+     * wasn't set up to timestamp it
+     */
+    struct timespec received;
+    std::size_t len;
+    char data[buffer_len];
+};
+
+using datagram = std::shared_ptr<const Datagram>;
+using datagrams = std::shared_ptr<const std::vector<datagram>>;
+
 /**
  * The "benchmark" maturities, or instruments we'll consider when building (via
  * polyfit) the yield curve.
@@ -185,73 +213,238 @@ void build_pipeline(uint8_t ticker, calcgraph::Connectable<double> &price,
 }
 
 /**
- * @brief Parse the given quotes into maturity-yield pairs.
+ * @brief Parse a quote like "10Y 2.15" in place, without allocating
+ * @details The yield must be followed by a non-numeric character (a
+ * Datagram's payload is always NUL-terminated).
+ * @returns false iff the quote is malformed
+ */
+static bool parse_quote(const char *begin, const char *end,
+                        std::pair<uint8_t, double> &out) {
+    const char *p = begin;
+    unsigned int maturity = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+        maturity = maturity * 10 + (*p - '0');
+        if (maturity > std::numeric_limits<uint8_t>::max())
+            return false;
+    }
+    if (p == begin)
+        return false; // no maturity
+
+    p = std::find(p, end, ' ');
+    if (p == end)
+        return false; // no yield
+    ++p;
+
+    char *parsed;
+    double yield = std::strtod(p, &parsed);
+    if (parsed == p || parsed > end)
+        return false;
+
+    out.first = maturity;
+    out.second = yield;
+    return true;
+}
+
+/**
+ * @brief Parse the given quotes into maturity-yield pairs, skipping any
+ * malformed ones
+ * @details The returned vector is reused by the next call if the downstream
+ * nodes haven't kept a reference to it, so in the steady state dispatching
+ * doesn't allocate any memory.
  */
-uint8double_vector dispatch(strings msgs) {
-    uint8double_vector ret =
-        uint8double_vector(new uint8double_vector::element_type());
-    for (auto msg : *msgs) {
-        uint8_t ticker = std::stoi(*msg);
-        double price = std::stod(msg->substr(msg->find(" ") + 1));
-        ret->emplace_back(ticker, price);
+uint8double_vector dispatch(datagrams msgs) {
+    static uint8double_vector ret;
+    if (!ret || ret.use_count() > 1) {
+        ret = uint8double_vector(new uint8double_vector::element_type());
+    }
+    ret->clear();
+    ret->reserve(msgs->size());
+
+    std::pair<uint8_t, double> quote;
+    for (const auto &msg : *msgs) {
+        if (parse_quote(msg->data, msg->data + msg->len, quote))
+            ret->push_back(quote);
     }
     return ret;
 }
 
 /**
- * @brief Set up a UDP socket and pass any (complete) received datagrams to the
- * Input.
- * @returns true iff the listening process started correctly
+ * @brief Reads UDP datagrams from a socket in batches and appends each batch
+ * to an Input
+ * @details Each recvmmsg call can fill up to recv_batch pooled Datagrams, and
+ * each batch is passed to the graph with a single Input::append_many, so the
+ * receiving Node is only scheduled once per batch.
  */
-bool listen_to_datagrams(calcgraph::Input<string> &&in) {
-    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (fd < 0) {
-        perror("socket");
-        return false;
+class DatagramReceiver final {
+  public:
+    /**
+     * @brief Options for the receiving socket
+     */
+    struct Options final {
+        /**
+         * @brief SO_BUSY_POLL microseconds, so the kernel spins on the device
+         * queue rather than waiting for an interrupt; zero to disable
+         */
+        int busy_poll_usecs = 0;
+
+        /**
+         * @brief Ask the kernel for SO_TIMESTAMPING software receive
+         * timestamps (stored in Datagram::received)
+         */
+        bool timestamps = false;
+    };
+
+    DatagramReceiver(Options opts) : opts(opts), fd(-1), ctrl() {
+        for (unsigned int i = 0; i < recv_batch; ++i) {
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            reset(i);
+        }
+        batch.reserve(recv_batch);
     }
-    int oval = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &oval, sizeof(oval)) < 0) {
-        perror("setsockopt SO_REUSEADDR");
-        return false;
+
+    ~DatagramReceiver() {
+        if (fd >= 0)
+            close(fd);
     }
 
-    // set up a timeout so we check the "stop" flag once a second (to break
-    // out
-    // of the receive loop)
-    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
-    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        perror("setsockopt SO_RCVTIMEO");
-        return false;
+    /**
+     * @brief Set up a UDP socket listening on the given port
+     * @returns true iff the socket was set up correctly
+     */
+    bool open(short port) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd < 0) {
+            perror("socket");
+            return false;
+        }
+        int oval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &oval, sizeof(oval)) <
+            0) {
+            perror("setsockopt SO_REUSEADDR");
+            return false;
+        }
+
+        // set up a timeout so we check the "stop" flag once a second (to
+        // break out of the receive loop)
+        struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+            perror("setsockopt SO_RCVTIMEO");
+            return false;
+        }
+        if (opts.busy_poll_usecs > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &opts.busy_poll_usecs,
+                       sizeof(opts.busy_poll_usecs)) < 0) {
+            perror("setsockopt SO_BUSY_POLL"); // not fatal
+        }
+        if (opts.timestamps) {
+            int flags =
+                SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+            if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+                           sizeof(flags)) < 0) {
+                perror("setsockopt SO_TIMESTAMPING"); // not fatal
+                opts.timestamps = false;
+            }
+        }
+
+        struct sockaddr_in myaddr = {.sin_family = AF_INET,
+                                     .sin_port = htons(port),
+                                     .sin_addr = {htonl(INADDR_ANY)}};
+        if (bind(fd, (struct sockaddr *)&myaddr, sizeof(myaddr)) < 0) {
+            perror("bind");
+            return false;
+        }
+        return true;
     }
-    struct sockaddr_in myaddr = {.sin_family = AF_INET,
-                                 .sin_addr = htonl(INADDR_ANY),
-                                 .sin_port = htons(PORT)};
-    if (bind(fd, (struct sockaddr *)&myaddr, sizeof(myaddr)) < 0) {
-        perror("bind");
-        return false;
+
+    /**
+     * @brief Pass any (complete) received datagrams to the Input until the
+     * stop flag is set
+     * @returns false iff receiving failed
+     */
+    bool run(calcgraph::Graph &graph, calcgraph::Input<datagram> &in,
+             const std::atomic<bool> &stop) {
+        while (!stop.load()) {
+            int received =
+                recvmmsg(fd, msgs, recv_batch, MSG_WAITFORONE, nullptr);
+            if (received < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINPROGRESS || errno == EINTR) {
+                    continue; // probably timeout
+                } else {
+                    perror("recvmmsg");
+                    return false;
+                }
+            }
+
+            for (int i = 0; i < received; ++i) {
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    reset(i); // skip broken packets, reusing the buffer
+                    continue;
+                }
+                Datagram &d = *buffers[i];
+                d.len = msgs[i].msg_len;
+                d.data[d.len] = '\0';
+                d.received = timestamp(msgs[i].msg_hdr);
+                batch.emplace_back(std::move(buffers[i]));
+                reset(i);
+            }
+
+            in.append_many(graph, std::make_move_iterator(batch.begin()),
+                           std::make_move_iterator(batch.end()));
+            batch.clear();
+        }
+        return true;
     }
 
-    char buffer[buffer_len];
-    struct iovec iov = {.iov_base = buffer, .iov_len = buffer_len};
-    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
-    int byterecv;
-    while (!stop.load()) {
-        if ((byterecv = recvmsg(fd, &msg, 0)) < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK ||
-                errno == EINPROGRESS || errno == EINTR) {
-                continue; // probably timeout
-            } else {
-                perror("recvmsg");
-                return false;
+  private:
+    Options opts;
+    int fd;
+
+    struct mmsghdr msgs[recv_batch];
+    struct iovec iovs[recv_batch];
+    std::shared_ptr<Datagram> buffers[recv_batch];
+    char ctrl[recv_batch][CMSG_SPACE(sizeof(struct scm_timestamping))];
+
+    /**
+     * @brief The datagrams received by the last recvmmsg call, kept so its
+     * storage is reused
+     */
+    std::vector<datagram> batch;
+
+    /**
+     * @brief Point the i'th message header at a fresh pooled Datagram
+     */
+    void reset(unsigned int i) {
+        if (!buffers[i] || buffers[i].use_count() > 1) {
+            buffers[i] = std::allocate_shared<Datagram>(
+                calcgraph::PoolAllocator<Datagram>());
+        }
+        iovs[i].iov_base = buffers[i]->data;
+        iovs[i].iov_len = buffer_len - 1; // leave room for the NUL
+        msgs[i].msg_hdr.msg_control = opts.timestamps ? ctrl[i] : nullptr;
+        msgs[i].msg_hdr.msg_controllen = opts.timestamps ? sizeof(ctrl[i]) : 0;
+        msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    /**
+     * @brief Find the software receive timestamp in a message's control data
+     */
+    struct timespec timestamp(struct msghdr &hdr) const {
+        struct timespec ts = {0, 0};
+        if (!opts.timestamps)
+            return ts;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); c;
+             c = CMSG_NXTHDR(&hdr, c)) {
+            if (c->cmsg_level == SOL_SOCKET &&
+                c->cmsg_type == SCM_TIMESTAMPING) {
+                ts = reinterpret_cast<struct scm_timestamping *>(
+                         CMSG_DATA(c))->ts[0];
             }
-        } else if (msg.msg_flags & MSG_TRUNC) {
-            continue; // skip broken packets
-        } else {
-            in.append(g, string(new std::string(buffer, byterecv)));
         }
+        return ts;
     }
-    return true;
-}
+};
 
 void install_sigint_handler() {
     auto handler = [](int sig) {
@@ -271,8 +464,10 @@ int main() {
     auto dispatcher =
         g.node()
             .propagate<calcgraph::OnChange>()
-            .output<calcgraph::MultiValued<calcgraph::Demultiplexed>::type>()
-            .accumulate(calcgraph::unconnected<string>())
+            // maturities are small integers, so index them directly
+            .output<calcgraph::MultiValued<calcgraph::DemultiplexedBy<
+                calcgraph::DenseIndex>::type>::type>()
+            .batched(calcgraph::unconnected<datagram>())
             .connect(dispatch);
 
     auto curve_fitter = g.node()
@@ -294,7 +489,9 @@ int main() {
                        new_pair->second);
     });
 
-    if (!listen_to_datagrams(dispatcher->input<0>())) {
+    DatagramReceiver receiver{DatagramReceiver::Options()};
+    auto in = dispatcher->input<0>();
+    if (!receiver.open(PORT) || !receiver.run(g, in, stop)) {
         stop.store(true);
     }
 
@@ -1,17 +1,23 @@
 #ifndef CALC_H
 #define CALC_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <forward_list>
-#include <unordered_map>
+#include <functional>
+#include <limits>
 #include <memory>
-#include <queue>
 #include <thread>
 #include <tuple>
+#include <type_traits>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <boost/intrusive_ptr.hpp>
 
@@ -29,13 +35,26 @@ namespace calcgraph {
     template <template <typename> class,
               template <template <typename> class, typename> class, class...>
     class NodeBuilder;
-    template <template <typename> class, typename>
-    class Demultiplexed;
+    template <template <typename, typename> class,
+              template <typename> class, typename>
+    class BasicDemultiplexed;
     template <typename>
     class KeyedOutput;
+    class Batch;
+    template <typename, std::size_t>
+    class Channel;
 
     /**
-     * @brief A less-than comparison of Work objects based on their ids
+     * @brief Which lane a Work item is evaluated in
+     * @details Graph evaluations drain every scheduled Work item in a higher
+     * lane before any in a lower one, in Work::id order within each lane.
+     */
+    enum class Priority : uint8_t { HIGH = 0, NORMAL = 1, LOW = 2 };
+    static const std::size_t PRIORITIES = 3;
+
+    /**
+     * @brief A less-than comparison of Work objects based on their priority
+     * lanes and then their ids
      */
     struct WorkQueueCmp {
         constexpr bool operator()(const Work *a, const Work *b) const;
@@ -45,16 +64,577 @@ namespace calcgraph {
     class Storeable {
       public:
         virtual void store(VAL v) = 0;
+
+        /**
+         * @brief Stores the value if there's room for it
+         * @details Only bounded Input policies (like Ring) can refuse a value;
+         * by default this just calls store.
+         * @returns false if the value was discarded
+         */
+        virtual bool try_store(VAL v) {
+            store(std::move(v));
+            return true;
+        }
+    };
+
+    /**
+     * @brief A lock-free pool of fixed-size blocks of memory, large enough to
+     * hold a T
+     * @details There's one pool per type T. Each thread allocates from its own
+     * private free list, which it refills from a shared lock-free stack of
+     * blocks that have been deallocated (by any thread), and only when that's
+     * empty allocates a new chunk of blocks from the heap. This means pooled
+     * objects allocated by one thread (e.g. a network listener appending to an
+     * Input) and freed by another (e.g. the Graph evaluation thread) are
+     * recycled without any calls to malloc or free once the pool has grown
+     * to its high-water mark. Memory is never returned to the heap.
+     *
+     * @tparam T The type of object to allocate space for
+     */
+    template <typename T>
+    class Pool final {
+      public:
+        /**
+         * @brief Get an uninitialized block big enough for a T
+         */
+        static void *allocate() {
+            if (!local) {
+                // take everything anyone's freed so far
+                local = returned.exchange(nullptr, std::memory_order_acquire);
+            }
+            if (!local) {
+                refill();
+            }
+            Block *b = local;
+            local = b->next;
+            return b;
+        }
+
+        /**
+         * @brief Put a block previously returned by allocate back in the pool
+         * @details Can be called from any thread
+         */
+        static void deallocate(void *p) {
+            Block *b = static_cast<Block *>(p);
+            b->next = returned.load(std::memory_order_relaxed);
+            while (!returned.compare_exchange_weak(b->next, b,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+            }
+        }
+
+      private:
+        union Block {
+            Block *next;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+        };
+
+        struct Chunk {
+            Chunk *next;
+            Block blocks[64];
+        };
+
+        /**
+         * @brief The head of this thread's private free list
+         */
+        static thread_local Block *local;
+
+        /**
+         * @brief Blocks deallocated by any thread, waiting to be taken by a
+         * thread that's run out
+         * @details A Treiber stack, but it's only ever popped by exchanging
+         * the whole stack so doesn't suffer from the ABA problem.
+         */
+        static std::atomic<Block *> returned;
+
+        /**
+         * @brief Every chunk ever allocated, so the memory's still reachable
+         */
+        static std::atomic<Chunk *> chunks;
+
+        static void refill() {
+            Chunk *c = new Chunk;
+            c->next = chunks.load(std::memory_order_relaxed);
+            while (!chunks.compare_exchange_weak(c->next, c)) {
+            }
+            for (std::size_t i = 0; i < 64; ++i) {
+                c->blocks[i].next = local;
+                local = &c->blocks[i];
+            }
+        }
+    };
+
+    template <typename T>
+    thread_local typename Pool<T>::Block *Pool<T>::local = nullptr;
+    template <typename T>
+    std::atomic<typename Pool<T>::Block *> Pool<T>::returned(nullptr);
+    template <typename T>
+    std::atomic<typename Pool<T>::Chunk *> Pool<T>::chunks(nullptr);
+
+    /**
+     * @brief A standard-library-compatible allocator backed by a Pool
+     * @details Single-object allocations (e.g. from std::allocate_shared) come
+     * from the Pool; allocations of arrays use the heap.
+     */
+    template <typename T>
+    struct PoolAllocator final {
+        using value_type = T;
+
+        PoolAllocator() noexcept {}
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+        T *allocate(std::size_t n) {
+            if (n == 1)
+                return static_cast<T *>(Pool<T>::allocate());
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T *p, std::size_t n) {
+            if (n == 1)
+                Pool<T>::deallocate(p);
+            else
+                ::operator delete(p);
+        }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U> &) const noexcept {
+            return true;
+        }
+        template <typename U>
+        bool operator!=(const PoolAllocator<U> &) const noexcept {
+            return false;
+        }
+    };
+
+    /**
+     * @brief A bump allocator that puts consecutively-allocated objects next
+     * to each other in memory
+     * @details Used by a Graph to allocate its Nodes, so the Nodes that make up
+     * a pipeline (which are usually built one after the other) are close
+     * together in memory. Memory is allocated in chunks, and each chunk is
+     * reference-counted (one reference per live object, plus one while the
+     * Arena's still allocating from it), so a chunk is freed once all the
+     * objects in it have been deallocated - even if that's after the Arena
+     * itself has been destroyed.
+     */
+    class Arena final {
+      public:
+        /**
+         * @brief Allocate memory for an object
+         * @details Thread-safe; uses a spinlock as it's only called when
+         * building the Graph.
+         */
+        void *allocate(std::size_t size);
+
+        /**
+         * @brief Allocate memory from the heap that can be passed to
+         * Arena::deallocate
+         */
+        static void *allocate_unpooled(std::size_t size);
+
+        /**
+         * @brief Free memory from either Arena::allocate or
+         * Arena::allocate_unpooled
+         * @details Can be called from any thread
+         */
+        static void deallocate(void *p);
+
+        /**
+         * @brief Allocate enough chunks for at least the given number of bytes
+         * of objects now, and touch every page of them from the calling thread
+         * @details Subsequent allocations use these chunks before allocating
+         * any more. On Linux a page is placed on the NUMA node of the thread
+         * that first touches it, so reserving from an evaluation thread means
+         * objects allocated later by a different (e.g. building) thread are
+         * still local to the evaluating core.
+         */
+        void reserve(std::size_t bytes);
+
+        Arena() noexcept : current(nullptr), spare(nullptr) {}
+        Arena(const Arena &) = delete;
+        ~Arena();
+
+      private:
+        struct Chunk;
+
+        /**
+         * @brief Stored immediately before each allocated object
+         */
+        struct alignas(std::max_align_t) Header {
+            /** @brief nullptr for allocate_unpooled memory */
+            Chunk *chunk;
+        };
+
+        Chunk *current;
+
+        /**
+         * @brief Chunks from Arena::reserve that haven't been allocated from
+         * yet
+         */
+        Chunk *spare;
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    };
+
+    /**
+     * @brief Epoch-based reclamation of values that lock-free readers may
+     * still be using
+     * @details Each Graph owns an Epoch, which its Nodes' inputs retire
+     * replaced values to; values stored anywhere else (e.g. a Latest sink
+     * that isn't part of a Node) use the process-wide shared() one. A thread
+     * "pins" an Epoch while it might be dereferencing values it protects (a
+     * Graph pins its own for the whole of each evaluation), and "retires"
+     * values it's unlinked rather than destroying them. Any thread can
+     * retire a value, which just pushes it onto a lock-free stack. A retired
+     * value is only destroyed once the Epoch has advanced twice, which can
+     * only happen after every thread that was pinned when it was retired has
+     * unpinned. Epochs are advanced and collected at quiescent points: a
+     * Graph collects its own and the shared Epoch at the end of every
+     * evaluation, so a value replaced between evaluations is destroyed a
+     * couple of evaluations later. Pinning an already-pinned thread just
+     * increments a counter. A thread's first pin of each Epoch takes a
+     * mutex (as does destroying an Epoch, and a thread exiting), but pinning
+     * and retiring are lock-free after that.
+     */
+    class Epoch final {
+      public:
+        /**
+         * @brief Keeps the calling thread pinned while it's in scope
+         */
+        class Guard final {
+          public:
+            explicit Guard(Epoch &epoch = Epoch::shared()) : epoch(epoch) {
+                epoch.pin();
+            }
+            ~Guard() { epoch.unpin(); }
+            Guard(const Guard &) = delete;
+
+          private:
+            Epoch &epoch;
+        };
+
+        void pin();
+        void unpin();
+
+        /**
+         * @brief Call the deleter on p once no pinned thread can be using it
+         * @details p must already be unreachable by threads that pin after
+         * this call. Thread-safe.
+         */
+        void retire(void *p, void (*deleter)(void *));
+
+        /**
+         * @brief Try to advance the epoch, and destroy any retired values
+         * it's now safe to
+         * @details Thread-safe; does nothing if another thread's already
+         * collecting. Also called after every 64 retirements, in case nothing
+         * else is.
+         */
+        void collect();
+
+        /**
+         * @brief The Epoch for values that don't belong to a Graph
+         */
+        static Epoch &shared();
+
+        Epoch();
+        Epoch(const Epoch &) = delete;
+
+        /**
+         * @brief Destroys everything still retired, so no thread can be
+         * pinned
+         */
+        ~Epoch();
+
+      private:
+        struct Record;
+        struct Retired;
+        struct Local;
+
+        /**
+         * @brief The calling thread's Record, claiming one on first use
+         */
+        Record &local();
+
+        /**
+         * @brief Never reused, so threads' cached Records can't be mistaken
+         * for those of a later Epoch at the same address
+         */
+        const uint64_t id;
+
+        std::atomic<uint64_t> global;
+
+        /**
+         * @brief Every Record created for this Epoch; a Record is reused by a
+         * new thread once its owning thread exits
+         */
+        std::atomic<Record *> records;
+
+        /**
+         * @brief Values retired since the last collect, as a Treiber stack
+         * that's only ever popped by exchanging the whole stack
+         */
+        std::atomic<Retired *> retired;
+        std::atomic<uint32_t> retired_since_collect;
+
+        /**
+         * @brief How many retired values haven't been destroyed yet, so
+         * collect can return early without touching anything shared
+         */
+        std::atomic<std::size_t> outstanding;
+
+        /**
+         * @brief Held while collecting, so retired values waiting for the
+         * epoch to advance can live in a plain vector
+         */
+        std::atomic_flag collecting = ATOMIC_FLAG_INIT;
+        std::vector<Retired *> limbo;
+        std::vector<Retired *> freeing;
+    };
+
+    /**
+     * @brief Tell an input policy which Epoch to retire replaced values to
+     * @details Used by Node, so its inputs use its Graph's Epoch. Policies
+     * without a bind method don't retire anything.
+     */
+    template <typename PART>
+    inline auto bind_epoch(PART &part, Epoch &epoch, int)
+        -> decltype(part.bind(epoch), void()) {
+        part.bind(epoch);
+    }
+    template <typename PART>
+    inline void bind_epoch(PART &, Epoch &, long) {}
+
+    /**
+     * @brief Read an input policy's value to pass to a Node's function
+     * @details Policies with a peek method hand over a reference to the value
+     * they store (only valid while their Epoch's pinned), so a function that
+     * takes it by const reference doesn't copy it; others are read().
+     */
+    template <typename PART>
+    inline auto read_input(PART &part, int) -> decltype(part.peek()) {
+        return part.peek();
+    }
+    template <typename PART>
+    inline auto read_input(PART &part, long) -> decltype(part.read()) {
+        return part.read();
+    }
+
+    /**
+     * @brief Copy a trivially-copyable VAL out of raw bytes
+     * @details Goes through suitably-aligned storage rather than
+     * default-constructing a VAL to memcpy into, so VAL doesn't need a
+     * default constructor.
+     */
+    template <typename VAL>
+    inline VAL bit_cast(const void *bytes) {
+        static_assert(std::is_trivially_copyable<VAL>::value,
+                      "bit_cast values must be trivially copyable");
+        typename std::aligned_storage<sizeof(VAL), alignof(VAL)>::type storage;
+        std::memcpy(&storage, bytes, sizeof(VAL));
+        return *reinterpret_cast<const VAL *>(&storage);
+    }
+
+    /**
+     * @brief A sequence lock protecting a trivially-copyable value of any size
+     * @details Has the same load, store and exchange interface as std::atomic
+     * (ignoring the memory orders, as it's always acquire-release). The value
+     * is held as an array of 64-bit words accessed with relaxed atomic
+     * operations, so a reader racing with a writer never tears a word and is
+     * well-defined; the reader just retries if the sequence number changed
+     * while it was copying. Writers serialize on the sequence number, but
+     * readers never block writers and never allocate.
+     */
+    template <typename VAL>
+    class SeqLock final {
+        static_assert(std::is_trivially_copyable<VAL>::value,
+                      "SeqLock values must be trivially copyable");
+
+      public:
+        VAL load(std::memory_order = std::memory_order_acquire) const {
+            uint64_t copy[WORDS];
+            while (true) {
+                uint64_t before = seq.load(std::memory_order_acquire);
+                if (before & 1) {
+                    std::this_thread::yield(); // a write's in progress
+                    continue;
+                }
+                for (std::size_t i = 0; i < WORDS; ++i) {
+                    copy[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == before)
+                    break;
+            }
+            return bit_cast<VAL>(copy);
+        }
+
+        void store(const VAL &v,
+                   std::memory_order = std::memory_order_release) {
+            uint64_t before = lock();
+            write(v);
+            seq.store(before + 2, std::memory_order_release);
+        }
+
+        VAL exchange(const VAL &v,
+                     std::memory_order = std::memory_order_acq_rel) {
+            uint64_t before = lock();
+            uint64_t copy[WORDS];
+            for (std::size_t i = 0; i < WORDS; ++i) {
+                copy[i] = words[i].load(std::memory_order_relaxed);
+            }
+            write(v);
+            seq.store(before + 2, std::memory_order_release);
+
+            return bit_cast<VAL>(copy);
+        }
+
+        SeqLock(const VAL &initial) noexcept : seq(0) { write(initial); }
+        SeqLock(const SeqLock &) = delete;
+
+      private:
+        static constexpr std::size_t WORDS =
+            (sizeof(VAL) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> words[WORDS];
+
+        /**
+         * @brief Make the sequence number odd, waiting for any other writer
+         * @returns the (even) sequence number before we locked it
+         */
+        uint64_t lock() {
+            uint64_t before = seq.load(std::memory_order_relaxed);
+            while ((before & 1) ||
+                   !seq.compare_exchange_weak(before, before + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                if (before & 1) {
+                    std::this_thread::yield();
+                    before = seq.load(std::memory_order_relaxed);
+                }
+            }
+            // order the odd sequence number before the words we write
+            std::atomic_thread_fence(std::memory_order_release);
+            return before;
+        }
+
+        void write(const VAL &v) {
+            uint64_t copy[WORDS] = {};
+            std::memcpy(copy, &v, sizeof(VAL));
+            for (std::size_t i = 0; i < WORDS; ++i) {
+                words[i].store(copy[i], std::memory_order_relaxed);
+            }
+        }
     };
 
+    /**
+     * @brief Whether Latest stores a VAL in a SeqLock rather than a
+     * std::atomic
+     * @details True for trivially-copyable types that std::atomic can't
+     * usually handle without a lock (anything bigger than 8 bytes, or whose
+     * size isn't a power of two).
+     */
+    template <typename VAL>
+    struct use_seqlock final
+        : std::integral_constant<bool,
+                                 std::is_trivially_copyable<VAL>::value &&
+                                     (sizeof(VAL) > sizeof(uint64_t) ||
+                                      (sizeof(VAL) & (sizeof(VAL) - 1)))> {};
+
+    /**
+     * @brief Whether a Checkpoint can save a VAL as its bytes and restore it
+     * after a restart
+     * @details True for trivially-copyable types that aren't pointers, as a
+     * saved address would dangle in the restarted process. Specialize it as
+     * std::false_type for trivially-copyable structs that hold pointers (or
+     * anything else that only means something to the process that saved
+     * it).
+     */
+    template <typename VAL>
+    struct checkpointable
+        : std::integral_constant<bool,
+                                 std::is_trivially_copyable<VAL>::value &&
+                                     !std::is_pointer<VAL>::value &&
+                                     !std::is_member_pointer<VAL>::value> {};
+
+    /**
+     * @brief Append part of a Node's state (e.g. one of its input policies)
+     * to a Checkpoint, as a 32-bit length followed by whatever the part's
+     * save method appends
+     * @details Parts without a save method (e.g. an Accumulate input, or a
+     * Latest input of values that aren't checkpointable) are saved as
+     * empty.
+     */
+    template <typename PART>
+    inline auto save_part(PART &part, std::string &out, int)
+        -> decltype(part.save(out), void()) {
+        std::size_t at = out.size();
+        out.append(sizeof(uint32_t), '\0');
+        part.save(out);
+        uint32_t len = static_cast<uint32_t>(out.size() - at - sizeof(len));
+        std::memcpy(&out[at], &len, sizeof(len));
+    }
+    template <typename PART>
+    inline void save_part(PART &, std::string &out, long) {
+        out.append(sizeof(uint32_t), '\0');
+    }
+    template <typename PART>
+    inline void save_part(PART &part, std::string &out) {
+        save_part(part, out, 0);
+    }
+
+    /**
+     * @brief Restore part of a Node's state saved by save_part, advancing
+     * first past it
+     * @param apply Whether to store the part, or only check that it could be
+     * @returns false if there isn't a whole part between first and last, or
+     * the part's restore method rejected it (e.g. as it's the wrong size)
+     */
+    template <typename PART>
+    inline auto restore_part(PART &part, const char *&first, const char *last,
+                             bool apply, int)
+        -> decltype(part.restore(first, last, apply), bool()) {
+        uint32_t len;
+        if (last - first < static_cast<std::ptrdiff_t>(sizeof(len)))
+            return false;
+        std::memcpy(&len, first, sizeof(len));
+        first += sizeof(len);
+        if (last - first < static_cast<std::ptrdiff_t>(len))
+            return false;
+        const char *data = first;
+        first += len;
+        return len == 0 || part.restore(data, data + len, apply);
+    }
+    template <typename PART>
+    inline bool restore_part(PART &, const char *&first, const char *last,
+                             bool, long) {
+        uint32_t len;
+        if (last - first < static_cast<std::ptrdiff_t>(sizeof(len)))
+            return false;
+        std::memcpy(&len, first, sizeof(len));
+        first += sizeof(len);
+        if (last - first < static_cast<std::ptrdiff_t>(len))
+            return false;
+        first += len;
+        return len == 0;
+    }
+    template <typename PART>
+    inline bool restore_part(PART &part, const char *&first, const char *last,
+                             bool apply) {
+        return restore_part(part, first, last, apply, 0);
+    }
+
     /**
      * @brief An input policy that returns the latest value of the Input to the
      * Node to use when its eval() method is called.
      * @details This object is embedded in the Node class, and atomically stores
-     * the current value of the input.
+     * the current value of the input. Trivially-copyable values that
+     * std::atomic would need a lock for (e.g. a struct of several fields) are
+     * kept in a SeqLock instead, so can be passed by value without a heap
+     * allocation or a lock.
      *
      * @tparam VAL The type of the value stored - must be supported by
-     * std::atomic.
+     * std::atomic, or be trivially copyable.
      */
     template <typename VAL>
     class Latest final : public Storeable<VAL> {
@@ -88,15 +668,47 @@ namespace calcgraph {
             return val.exchange(other, std::memory_order_acq_rel);
         }
 
+        /**
+         * @brief Append the stored value's bytes, for a Checkpoint
+         * @details Only for checkpointable values.
+         */
+        template <typename V = VAL,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline void save(std::string &out) {
+            VAL v = read();
+            out.append(reinterpret_cast<const char *>(&v), sizeof(VAL));
+        }
+
+        /**
+         * @brief Store a value saved by save (if apply is set)
+         * @returns false if it's the wrong size
+         */
+        template <typename V = VAL,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline bool restore(const char *first, const char *last, bool apply) {
+            if (last - first != sizeof(VAL))
+                return false;
+            if (apply)
+                store(bit_cast<VAL>(first));
+            return true;
+        }
+
         Latest(input_type initial = {}) noexcept : val(initial) {}
         Latest(const Latest &other) = delete;
 
       private:
-        std::atomic<VAL> val;
+        typename std::conditional<use_seqlock<VAL>::value, SeqLock<VAL>,
+                                  std::atomic<VAL>>::type val;
     };
 
     /**
      * @brief A partial specialization of Latest for std::shared_ptr
+     * @details The std::shared_ptr is kept in a pooled box that's swapped in
+     * with a single atomic exchange, and replaced boxes are passed to Epoch
+     * to destroy once no reader can be copying from them, so neither storing
+     * nor reading takes a lock. A Node passes its function a reference to
+     * the boxed std::shared_ptr itself (see peek), so a function that takes
+     * it by const reference doesn't touch the reference count.
      * @tparam VAL the type of the value the std::shared_ptr points to
      */
     template <typename VAL>
@@ -107,27 +719,90 @@ namespace calcgraph {
         using output_type = std::shared_ptr<VAL>;
 
         inline void store(input_type v) override {
-            std::atomic_store_explicit(&val, v, std::memory_order_release);
+            retire(val.exchange(box(std::move(v)), std::memory_order_acq_rel));
         }
         inline output_type read() {
-            return std::atomic_load_explicit(&val, std::memory_order_acquire);
+            Epoch::Guard pinned(*epoch);
+            Box *b = val.load(std::memory_order_acquire);
+            return b ? b->ptr : nullptr;
+        }
+
+        /**
+         * @brief The stored pointer, without touching its reference count
+         * @details Only valid until the calling thread unpins the Epoch this
+         * is bound to, which must be pinned (as a Graph's is when it's
+         * evaluating a Node).
+         */
+        inline VAL *borrow() {
+            Box *b = val.load(std::memory_order_acquire);
+            return b ? b->ptr.get() : nullptr;
+        }
+
+        /**
+         * @brief The stored std::shared_ptr itself, without copying it
+         * @details Only valid while the Epoch this is bound to is pinned, like
+         * borrow.
+         */
+        inline const output_type &peek() {
+            static const output_type none;
+            Box *b = val.load(std::memory_order_acquire);
+            return b ? b->ptr : none;
         }
+
+        /**
+         * @brief Retire replaced values to the given Epoch rather than the
+         * shared one
+         * @details Must be called before anything's stored.
+         */
+        inline void bind(Epoch &to) { epoch = &to; }
+
         inline input_type exchange(input_type other) {
-            return std::atomic_exchange_explicit(&val, other,
-                                                 std::memory_order_acq_rel);
+            Epoch::Guard pinned(*epoch);
+            Box *b = val.exchange(box(std::move(other)),
+                                  std::memory_order_acq_rel);
+            if (!b)
+                return nullptr;
+            // readers might still be copying from the box, so copy rather
+            // than move
+            input_type previous = b->ptr;
+            retire(b);
+            return previous;
         }
 
-        Latest(input_type initial = {}) noexcept : val(initial) {}
+        Latest(input_type initial = {}) noexcept
+            : val(box(std::move(initial))), epoch(&Epoch::shared()) {}
         Latest(const Latest &other) = delete;
+        ~Latest() { delete val.load(std::memory_order_acquire); }
 
       private:
-        std::shared_ptr<VAL> val;
+        struct Box final {
+            std::shared_ptr<VAL> ptr;
+
+            static void *operator new(std::size_t) {
+                return Pool<Box>::allocate();
+            }
+            static void operator delete(void *p) { Pool<Box>::deallocate(p); }
+        };
+
+        static Box *box(input_type v) {
+            return v ? new Box{std::move(v)} : nullptr;
+        }
+
+        void retire(Box *b) {
+            if (b)
+                epoch->retire(b, [](void *p) { delete static_cast<Box *>(p); });
+        }
+
+        std::atomic<Box *> val;
+        Epoch *epoch;
     };
 
     /**
      * @brief A partial specialization of Latest for boost::intrusive_ptr
      * @details This class keeps one reference to any value stored here, even if
-     *the actual member type stored is a raw pointer.
+     *the actual member type stored is a raw pointer. The reference to a
+     *replaced value is only released once Epoch says no reader can be about to
+     *add its own reference to it.
      *
      * @tparam VAL the type of the value the boost::intrusive_ptr points to
      */
@@ -139,29 +814,48 @@ namespace calcgraph {
         using output_type = boost::intrusive_ptr<VAL>;
 
         /**
-         * @brief Stores a new pointer
-         * @details Uses exchange to decrement the reference count (and possibly
-         * destroy) the value that was previously stored there when the returned
-         * intrusive_ptr is destroyed as it goes out of scope at the end of this
-         * function.
+         * @brief Stores a new pointer, retiring our reference to the value
+         * that was previously stored there
          */
-        inline void store(input_type v) override { exchange(v); }
+        inline void store(input_type v) override {
+            retire(val.exchange(v.detach(), std::memory_order_acq_rel));
+        }
 
         /**
          * @brief Coverts the stored raw pointer back to an intrusive one,
-         * without altering the reference count
+         * adding a reference for the caller
          */
         inline output_type read() {
+            Epoch::Guard pinned(*epoch);
             return boost::intrusive_ptr<VAL>(
-                val.load(std::memory_order_consume), false);
+                val.load(std::memory_order_acquire));
         }
 
+        /**
+         * @brief The stored pointer, without touching its reference count
+         * @details Only valid until the calling thread unpins the Epoch this
+         * is bound to.
+         */
+        inline VAL *borrow() { return val.load(std::memory_order_acquire); }
+
+        /**
+         * @brief Retire replaced values to the given Epoch rather than the
+         * shared one
+         * @details Must be called before anything's stored.
+         */
+        inline void bind(Epoch &to) { epoch = &to; }
+
         inline input_type exchange(input_type other) {
-            return boost::intrusive_ptr<VAL>(
-                val.exchange(other.detach(), std::memory_order_acq_rel), false);
+            Epoch::Guard pinned(*epoch);
+            VAL *previous =
+                val.exchange(other.detach(), std::memory_order_acq_rel);
+            boost::intrusive_ptr<VAL> ret(previous);
+            retire(previous);
+            return ret;
         }
 
-        Latest(input_type initial = {}) noexcept : val() { store(initial); }
+        Latest(input_type initial = {}) noexcept
+            : val(initial.detach()), epoch(&Epoch::shared()) {}
         Latest(const Latest &other) = delete;
 
         /**
@@ -174,7 +868,46 @@ namespace calcgraph {
         }
 
       private:
+        void retire(VAL *v) {
+            if (v)
+                epoch->retire(v, [](void *p) {
+                    intrusive_ptr_release(static_cast<VAL *>(p));
+                });
+        }
+
         std::atomic<VAL *> val;
+        Epoch *epoch;
+    };
+
+    /**
+     * @brief An input policy that passes a Node's function a raw pointer to
+     * the latest value stored, without any reference counting
+     * @details Stores values like Latest, but the function gets a const VAL*
+     * (or nullptr) that's only valid for the duration of the call, as the
+     * value is only kept alive by the Graph's Epoch pin. Unlike a Latest
+     * input, the function can't keep a reference to the value. Only supports
+     * std::shared_ptr values.
+     */
+    template <typename VAL>
+    class Borrowed;
+
+    template <typename VAL>
+    class Borrowed<std::shared_ptr<VAL>> final
+        : public Storeable<std::shared_ptr<VAL>> {
+      public:
+        using input_type = std::shared_ptr<VAL>;
+        using output_type = const VAL *;
+
+        inline void store(input_type v) override { latest.store(std::move(v)); }
+        inline output_type read() { return latest.borrow(); }
+        inline void bind(Epoch &to) { latest.bind(to); }
+
+        Borrowed(input_type initial = {}) noexcept
+            : latest(std::move(initial)) {}
+        Borrowed(const Borrowed &other) = delete;
+
+      private:
+        Latest<std::shared_ptr<VAL>> latest;
     };
 
     /**
@@ -194,6 +927,8 @@ namespace calcgraph {
         /**
          * @brief Atomically adds another value to the ones we've accumulated so
          * far
+         * @details The list elements come from a Pool, so don't usually need
+         * any heap allocation.
          */
         inline void store(input_type val) override {
             Element *e = new Element(std::move(val));
@@ -234,123 +969,1201 @@ namespace calcgraph {
             std::atomic<Element *> next;
             VAL val;
             Element(VAL &&val) : next(), val(val) {}
+
+            static void *operator new(std::size_t) {
+                return Pool<Element>::allocate();
+            }
+            static void operator delete(void *p) {
+                Pool<Element>::deallocate(p);
+            }
         };
 
         std::atomic<Element *> head;
     };
 
     /**
-     * @brief An input policy that converts many inputs into a std::vector of
-     * values
-     * @details [long description]
+     * @brief An Input policy that accumulates any values fed to it like
+     * Accumulate, but returns them to its containing Node as a std::vector
+     * that's recycled across evaluations
+     * @details Storing a value is the same lock-free push of a pooled element
+     * as Accumulate. When read, the values are moved into a std::vector that's
+     * reused if the Node didn't hold on to the previous batch, so once the
+     * vector's grown to fit the largest batch, reads don't allocate. If no
+     * values have arrived, read() returns a shared, empty singleton batch
+     * without allocating anything.
      *
-     * @tparam VAL The type of the value stored - must be be atomic
+     * @tparam VAL The type of the value stored - doesn't have to be atomic
      */
     template <typename VAL>
-    class Variadic final : public Storeable<std::nullptr_t> {
+    class Batched final : public Storeable<VAL> {
       public:
-        using input_type = std::nullptr_t;
-        using output_type = std::shared_ptr<std::vector<VAL>>;
+        using input_type = VAL;
+        using output_type = std::shared_ptr<const std::vector<VAL>>;
+
+        /**
+         * @brief Atomically adds another value to the ones we've accumulated so
+         * far
+         */
+        inline void store(input_type val) override {
+            Element *e = new Element(std::move(val));
+            while (true) {
+                Element *snap = head.load(std::memory_order_acquire);
+                e->next.store(snap, std::memory_order_release);
+                if (head.compare_exchange_weak(snap, e))
+                    return;
+            }
+        }
+
+        /**
+         * @brief Used by the node to extract any stored values its eval()
+         * method is called.
+         * @returns A (possibly empty) vector of the values received since the
+         * last call to read(), in the order they were received.
+         */
+        inline output_type read() {
+            Element *e = head.exchange(nullptr, std::memory_order_acq_rel);
+            if (e == nullptr)
+                return empty();
+
+            // the stack's in reverse order, so reverse it in-place first
+            Element *reversed = nullptr;
+            while (e != nullptr) {
+                Element *next = e->next.load(std::memory_order_relaxed);
+                e->next.store(reversed, std::memory_order_relaxed);
+                reversed = e;
+                e = next;
+            }
+
+            // only we hold the last batch, so no-one else can be reading it
+            if (!batch || batch.use_count() != 1) {
+                batch = std::make_shared<std::vector<VAL>>();
+            } else {
+                batch->clear();
+            }
+
+            while (reversed != nullptr) {
+                batch->push_back(std::move(reversed->val));
+                Element *next = reversed->next.load(std::memory_order_relaxed);
+                delete reversed;
+                reversed = next;
+            }
+            return batch;
+        }
+
+        Batched(input_type initial = {}) noexcept : head(), batch() {}
+        Batched(const Batched &other) = delete;
+
+        /**
+         * @brief Frees any values that were stored but never read
+         */
+        ~Batched() {
+            Element *e = head.load(std::memory_order_acquire);
+            while (e != nullptr) {
+                Element *next = e->next.load(std::memory_order_relaxed);
+                delete e;
+                e = next;
+            }
+        }
+
+      private:
+        struct Element final {
+            std::atomic<Element *> next;
+            VAL val;
+            Element(VAL &&val) : next(), val(std::move(val)) {}
+
+            static void *operator new(std::size_t) {
+                return Pool<Element>::allocate();
+            }
+            static void operator delete(void *p) {
+                Pool<Element>::deallocate(p);
+            }
+        };
+
+        static const output_type &empty() {
+            static const output_type singleton =
+                std::make_shared<const std::vector<VAL>>();
+            return singleton;
+        }
+
+        std::atomic<Element *> head;
+
+        /**
+         * @brief The vector returned by the last call to read(), only
+         * accessed under the containing Node's lock
+         */
+        std::shared_ptr<std::vector<VAL>> batch;
+    };
+
+    /**
+     * @brief What a Ring input policy should do when a new value arrives and
+     * it's already full
+     */
+    enum class Overflow {
+        /**
+         * @brief Discard the oldest value in the Ring to make room for the new
+         * one
+         */
+        DROP_OLDEST,
+        /**
+         * @brief Discard the new value, keeping the ones already in the Ring
+         */
+        DROP_NEWEST,
+        /**
+         * @brief Discard the new value, and make Input::try_append return
+         * false so the producer can apply backpressure
+         */
+        REJECT
+    };
+
+    /**
+     * @brief A fixed-capacity lock-free multi-producer multi-consumer queue
+     * @details Dmitry Vyukov's bounded queue: each cell carries a sequence
+     * number that tells producers and consumers whether it's free to write or
+     * ready to read, so the only contention is on the enqueue and dequeue
+     * counters. Never allocates memory after construction.
+     *
+     * @tparam T The type of value stored, which must be default-constructible
+     * @tparam N The capacity of the queue, which must be a power of two
+     */
+    template <typename T, std::size_t N>
+    class BoundedQueue final {
+        static_assert(N > 0 && (N & (N - 1)) == 0,
+                      "BoundedQueue capacity must be a power of two");
+
+      public:
+        /**
+         * @brief Add a value to the back of the queue
+         * @returns false (without moving from v) if the queue was full
+         */
+        bool push(T &v) {
+            Cell *cell;
+            std::size_t pos = enqueued.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &cells[pos & (N - 1)];
+                std::size_t seq = cell->seq.load(std::memory_order_acquire);
+                std::intptr_t diff =
+                    static_cast<std::intptr_t>(seq) -
+                    static_cast<std::intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueued.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueued.load(std::memory_order_relaxed);
+                }
+            }
+            cell->val = std::move(v);
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Remove the value at the front of the queue
+         * @returns false (leaving v untouched) if the queue was empty
+         */
+        bool pop(T &v) {
+            Cell *cell;
+            std::size_t pos = dequeued.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &cells[pos & (N - 1)];
+                std::size_t seq = cell->seq.load(std::memory_order_acquire);
+                std::intptr_t diff =
+                    static_cast<std::intptr_t>(seq) -
+                    static_cast<std::intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeued.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeued.load(std::memory_order_relaxed);
+                }
+            }
+            v = std::move(cell->val);
+            cell->seq.store(pos + N, std::memory_order_release);
+            return true;
+        }
+
+        BoundedQueue() : enqueued(0), dequeued(0) {
+            for (std::size_t i = 0; i < N; ++i)
+                cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        BoundedQueue(const BoundedQueue &other) = delete;
+
+      private:
+        struct Cell final {
+            std::atomic<std::size_t> seq;
+            T val;
+        };
+
+        /**
+         * @details The counters are padded onto separate cache lines (rather
+         * than using alignas, as Nodes containing a BoundedQueue are allocated
+         * from an Arena that only guarantees alignment to max_align_t) so
+         * producers and the consumer don't falsely share them.
+         */
+        Cell cells[N];
+        char pad1[64];
+        std::atomic<std::size_t> enqueued;
+        char pad2[64 - sizeof(std::atomic<std::size_t>)];
+        std::atomic<std::size_t> dequeued;
+    };
+
+    /**
+     * @brief A fixed-capacity lock-free single-producer single-consumer queue
+     * @details Each side keeps a cached copy of the other side's counter, so
+     * in the steady state a push or pop only touches cache lines the other
+     * thread isn't writing to. Never allocates memory after construction.
+     *
+     * @tparam T The type of value stored, which must be default-constructible
+     * @tparam N The capacity of the queue, which must be a power of two
+     */
+    template <typename T, std::size_t N>
+    class SpscQueue final {
+        static_assert(N > 0 && (N & (N - 1)) == 0,
+                      "SpscQueue capacity must be a power of two");
+
+      public:
+        /**
+         * @brief Add a value to the back of the queue; only call from the
+         * producer thread
+         * @returns false (without moving from v) if the queue was full
+         */
+        bool push(T &v) {
+            std::size_t pos = enqueued.load(std::memory_order_relaxed);
+            if (pos - dequeued_cache == N) {
+                dequeued_cache = dequeued.load(std::memory_order_acquire);
+                if (pos - dequeued_cache == N)
+                    return false;
+            }
+            cells[pos & (N - 1)] = std::move(v);
+            enqueued.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Remove the value at the front of the queue; only call from
+         * the consumer thread
+         * @returns false (leaving v untouched) if the queue was empty
+         */
+        bool pop(T &v) {
+            std::size_t pos = dequeued.load(std::memory_order_relaxed);
+            if (pos == enqueued_cache) {
+                enqueued_cache = enqueued.load(std::memory_order_acquire);
+                if (pos == enqueued_cache)
+                    return false;
+            }
+            v = std::move(cells[pos & (N - 1)]);
+            dequeued.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Whether the queue is empty; can be called from any thread
+         */
+        bool empty() const {
+            return dequeued.load(std::memory_order_acquire) ==
+                   enqueued.load(std::memory_order_acquire);
+        }
+
+        SpscQueue()
+            : cells(), enqueued(0), dequeued_cache(0), dequeued(0),
+              enqueued_cache(0) {}
+        SpscQueue(const SpscQueue &other) = delete;
+
+      private:
+        /**
+         * @details As with BoundedQueue, each side's counters are padded onto
+         * their own cache line.
+         */
+        T cells[N];
+        char pad1[64];
+        std::atomic<std::size_t> enqueued;
+        std::size_t dequeued_cache;
+        char pad2[64 - sizeof(std::atomic<std::size_t>) - sizeof(std::size_t)];
+        std::atomic<std::size_t> dequeued;
+        std::size_t enqueued_cache;
+    };
+
+    /**
+     * @brief A read-only view of a contiguous range of values
+     * @details Doesn't own the values it points to.
+     */
+    template <typename T>
+    class View final {
+      public:
+        using value_type = T;
+        using const_iterator = const T *;
+
+        inline const T *begin() const { return first; }
+        inline const T *end() const { return last; }
+        inline std::size_t size() const { return last - first; }
+        inline bool empty() const { return first == last; }
+        inline const T &operator[](std::size_t i) const { return first[i]; }
+
+        View(const T *first = nullptr, const T *last = nullptr) noexcept
+            : first(first),
+              last(last) {}
+
+      private:
+        const T *first;
+        const T *last;
+    };
+
+    /**
+     * @brief An Input policy that buffers up to N values in a fixed-capacity
+     * lock-free ring, and passes them all to its containing Node as a View in
+     * the order they were received
+     * @details A bounded alternative to Accumulate: storing a value doesn't
+     * allocate memory, and reading them is a linear scan rather than a walk of
+     * a linked list. What happens when the ring is full is controlled by the
+     * Overflow parameter. Use as Ring<N, O>::type.
+     *
+     * @tparam N The capacity of the ring, which must be a power of two
+     * @tparam O What to do when a value arrives and the ring is full
+     */
+    template <std::size_t N, Overflow O = Overflow::DROP_OLDEST>
+    struct Ring final {
+        /**
+         * @tparam VAL The type of the value stored - doesn't have to be atomic,
+         * but must be default-constructible
+         */
+        template <typename VAL>
+        class type final : public Storeable<VAL> {
+          public:
+            using input_type = VAL;
+            using output_type = View<VAL>;
+
+            inline void store(input_type val) override { try_store(val); }
+
+            /**
+             * @brief Add a value to the ring, applying the Overflow policy if
+             * it's full
+             * @returns false only if the Overflow policy is REJECT and the
+             * value was discarded
+             */
+            inline bool try_store(input_type val) override {
+                if (pending.push(val))
+                    return true;
+
+                switch (O) {
+                case Overflow::DROP_OLDEST:
+                    // the node might drain the ring concurrently, so keep
+                    // trying until there's room
+                    do {
+                        VAL oldest;
+                        pending.pop(oldest);
+                    } while (!pending.push(val));
+                    return true;
+                case Overflow::DROP_NEWEST:
+                    return true;
+                case Overflow::REJECT:
+                default:
+                    return false;
+                }
+            }
+
+            /**
+             * @brief Used by the node to extract any stored values when its
+             * eval() method is called.
+             * @returns A View of the values received since the last call to
+             * read(), in the order they were received. It's only valid until
+             * the next call to read().
+             */
+            inline output_type read() {
+                drained.clear();
+                VAL v;
+                while (drained.size() < N && pending.pop(v))
+                    drained.push_back(std::move(v));
+                return output_type(drained.data(),
+                                   drained.data() + drained.size());
+            }
+
+            type(input_type initial = {}) : pending(), drained() {
+                drained.reserve(N);
+            }
+            type(const type &other) = delete;
+
+          private:
+            BoundedQueue<VAL, N> pending;
+
+            /**
+             * @brief The values returned by the last call to read()
+             * @details Reserved to the capacity of the ring up front, and only
+             * accessed under the containing Node's lock.
+             */
+            std::vector<VAL> drained;
+        };
+    };
+
+    /**
+     * @brief An input policy that converts many inputs into a std::vector of
+     * values
+     * @details Each input is a slot holding a Latest value. The slots live in a
+     * std::deque (so they've got stable addresses that Inputs can point to, and
+     * appending one is O(1)) and are indexed by a dense vector of the live
+     * slots, so reading them is a sequential scan and removing one is an O(1)
+     * swap with the last. This means removing an input changes the order of
+     * the values in the output vector: the last input takes the removed
+     * input's place. Removed slots are reused by later calls to add_input.
+     *
+     * @tparam VAL The type of the value stored - must be be atomic
+     */
+    template <typename VAL>
+    class Variadic final : public Storeable<std::nullptr_t> {
+      public:
+        using input_type = std::nullptr_t;
+        using output_type = std::shared_ptr<std::vector<VAL>>;
         using element_type = VAL;
 
         /**
          * @brief Should not be called directly, instead use new_input to get an
          * Input to append values to
          */
-        inline void store(input_type val) override { std::abort(); }
+        inline void store(input_type val) override { std::abort(); }
+
+        /**
+         * @brief Used by the Node to extract the current list of latest values
+         * from the inputs.
+         * @details Called by Node when the lock is held, so accesses the inputs
+         * vector in a thread-safe manner. The output vector is reused if no-one
+         * else holds on to the one returned by the previous call.
+         * @returns A non-null (but possibly empty) std::vector, with one value
+         * for each input created by new_input().
+         */
+        inline output_type read() {
+            if (!out || out.use_count() != 1) {
+                out = std::make_shared<std::vector<VAL>>();
+                out->reserve(live.size());
+            } else {
+                out->clear();
+            }
+            for (Slot *slot : live) {
+                out->push_back(slot->val.read());
+            }
+            return out;
+        }
+
+        /**
+         * @brief Append the number of inputs and each one's value, for a
+         * Checkpoint
+         * @details Only for checkpointable values. Must hold the Node's
+         * lock.
+         */
+        template <typename V = VAL,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline void save(std::string &out) {
+            uint32_t n = static_cast<uint32_t>(live.size());
+            out.append(reinterpret_cast<const char *>(&n), sizeof(n));
+            for (Slot *slot : live) {
+                VAL v = slot->val.read();
+                out.append(reinterpret_cast<const char *>(&v), sizeof(VAL));
+            }
+        }
+
+        /**
+         * @brief Store values saved by save in the inputs, in order (if
+         * apply is set)
+         * @details Must hold the Node's lock.
+         * @returns false if the saved values are the wrong size, or there
+         * are a different number of inputs now
+         */
+        template <typename V = VAL,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline bool restore(const char *first, const char *last, bool apply) {
+            uint32_t n;
+            if (last - first < static_cast<std::ptrdiff_t>(sizeof(n)))
+                return false;
+            std::memcpy(&n, first, sizeof(n));
+            first += sizeof(n);
+            if (n != live.size() ||
+                last - first != static_cast<std::ptrdiff_t>(n * sizeof(VAL)))
+                return false;
+            for (std::size_t i = 0; apply && i < n; ++i) {
+                live[i]->val.store(bit_cast<VAL>(first + i * sizeof(VAL)));
+            }
+            return true;
+        }
+
+        Variadic(input_type initial = nullptr) noexcept : slots(),
+                                                          live(),
+                                                          unused(),
+                                                          out() {}
+        Variadic(const Variadic &other) = delete;
+
+      private:
+        /**
+         * @brief The storage for a single input
+         */
+        class Slot final : public Storeable<VAL> {
+          public:
+            inline void store(VAL v) override { val.store(v); }
+
+            Slot(VAL initial) : val(initial), position(0) {}
+
+            Latest<VAL> val;
+
+            /**
+             * @brief This slot's index in Variadic::live
+             */
+            std::size_t position;
+        };
+
+        /**
+         * @brief The storage for all the inputs, live or not, guarded by the
+         * containing Node's lock
+         * @details A std::deque, not a std::vector as we can't move the Latest
+         * objects (as std:atomics aren't copy-constructible), so we can't
+         * resize a vector.
+         */
+        std::deque<Slot> slots;
+
+        /**
+         * @brief The inputs in the order their values appear in the output
+         */
+        std::vector<Slot *> live;
+
+        /**
+         * @brief Slots that have been removed and can be reused
+         */
+        std::vector<Slot *> unused;
+
+        /**
+         * @brief The vector returned by the last call to read()
+         */
+        output_type out;
+
+        /**
+         * @brief Creates a new input for the output vector and returns it.
+         * @details Always created at the end. Only call when the containing
+         * Node's lock is held.
+         */
+        inline Storeable<VAL> &add_input(VAL initial = {}) {
+            Slot *slot;
+            if (unused.empty()) {
+                slots.emplace_back(initial);
+                slot = &slots.back();
+            } else {
+                slot = unused.back();
+                unused.pop_back();
+                slot->val.store(initial);
+            }
+            slot->position = live.size();
+            live.push_back(slot);
+            return *slot;
+        }
+
+        /**
+         * @brief Removes an input created by add_input from the list
+         * @details Only call when the containing Node's lock is held. The last
+         * input is moved into the removed input's position.
+         */
+        inline void remove_input(Storeable<VAL> *it) {
+            Slot *slot = static_cast<Slot *>(it);
+            if (slot->position >= live.size() || live[slot->position] != slot)
+                return; // already removed
+
+            Slot *last = live.back();
+            live[slot->position] = last;
+            last->position = slot->position;
+            live.pop_back();
+
+            // don't keep the last value alive while the slot's unused
+            slot->val.store(VAL{});
+            unused.push_back(slot);
+        }
+
+        template <template <typename> class,
+                  template <template <typename> class, typename> class,
+                  typename, typename...>
+        friend class Node;
+    };
+
+    /**
+     * @brief Reductions over contiguous arrays of values, such as the
+     * std::vector passed to a function by a Variadic input
+     * @details Each one keeps LANES independent partial results and combines
+     * them at the end, so the compiler can keep the partial results in one
+     * vector register and vectorize the loop without needing -ffast-math to
+     * reorder the operations. Floating-point sums may therefore differ in the
+     * last few bits from a sequential std::accumulate.
+     */
+    namespace reduce {
+        static const std::size_t LANES = 8;
+
+        /**
+         * @brief The sum of the values, or zero if there are none
+         */
+        template <typename VAL>
+        inline VAL sum(const VAL *first, const VAL *last) {
+            VAL acc[LANES] = {};
+            std::size_t n = last - first, i = 0;
+            for (; i + LANES <= n; i += LANES) {
+                for (std::size_t j = 0; j < LANES; ++j)
+                    acc[j] += first[i + j];
+            }
+            VAL total{};
+            for (; i < n; ++i)
+                total += first[i];
+            for (std::size_t j = 0; j < LANES; ++j)
+                total += acc[j];
+            return total;
+        }
+
+        /**
+         * @brief The sum of the products of the corresponding values in two
+         * arrays of n values
+         */
+        template <typename VAL>
+        inline VAL dot(const VAL *a, const VAL *b, std::size_t n) {
+            VAL acc[LANES] = {};
+            std::size_t i = 0;
+            for (; i + LANES <= n; i += LANES) {
+                for (std::size_t j = 0; j < LANES; ++j)
+                    acc[j] += a[i + j] * b[i + j];
+            }
+            VAL total{};
+            for (; i < n; ++i)
+                total += a[i] * b[i];
+            for (std::size_t j = 0; j < LANES; ++j)
+                total += acc[j];
+            return total;
+        }
+
+        /**
+         * @brief The smallest value, or the largest representable value (or
+         * infinity, if there is one) if there are none
+         */
+        template <typename VAL>
+        inline VAL min(const VAL *first, const VAL *last) {
+            const VAL identity = std::numeric_limits<VAL>::has_infinity
+                                     ? std::numeric_limits<VAL>::infinity()
+                                     : std::numeric_limits<VAL>::max();
+            VAL acc[LANES];
+            std::fill(acc, acc + LANES, identity);
+            std::size_t n = last - first, i = 0;
+            for (; i + LANES <= n; i += LANES) {
+                for (std::size_t j = 0; j < LANES; ++j)
+                    acc[j] = first[i + j] < acc[j] ? first[i + j] : acc[j];
+            }
+            VAL ret = identity;
+            for (; i < n; ++i)
+                ret = first[i] < ret ? first[i] : ret;
+            for (std::size_t j = 0; j < LANES; ++j)
+                ret = acc[j] < ret ? acc[j] : ret;
+            return ret;
+        }
+
+        /**
+         * @brief The largest value, or the smallest representable value (or
+         * minus infinity, if there is one) if there are none
+         */
+        template <typename VAL>
+        inline VAL max(const VAL *first, const VAL *last) {
+            const VAL identity = std::numeric_limits<VAL>::has_infinity
+                                     ? -std::numeric_limits<VAL>::infinity()
+                                     : std::numeric_limits<VAL>::lowest();
+            VAL acc[LANES];
+            std::fill(acc, acc + LANES, identity);
+            std::size_t n = last - first, i = 0;
+            for (; i + LANES <= n; i += LANES) {
+                for (std::size_t j = 0; j < LANES; ++j)
+                    acc[j] = first[i + j] > acc[j] ? first[i + j] : acc[j];
+            }
+            VAL ret = identity;
+            for (; i < n; ++i)
+                ret = first[i] > ret ? first[i] : ret;
+            for (std::size_t j = 0; j < LANES; ++j)
+                ret = acc[j] > ret ? acc[j] : ret;
+            return ret;
+        }
+
+        template <typename VAL>
+        inline VAL sum(const std::vector<VAL> &vals) {
+            return sum(vals.data(), vals.data() + vals.size());
+        }
+        template <typename VAL>
+        inline VAL sum(const View<VAL> &vals) {
+            return sum(vals.begin(), vals.end());
+        }
+        template <typename VAL>
+        inline VAL dot(const std::vector<VAL> &a, const std::vector<VAL> &b) {
+            return dot(a.data(), b.data(), std::min(a.size(), b.size()));
+        }
+        template <typename VAL>
+        inline VAL min(const std::vector<VAL> &vals) {
+            return min(vals.data(), vals.data() + vals.size());
+        }
+        template <typename VAL>
+        inline VAL min(const View<VAL> &vals) {
+            return min(vals.begin(), vals.end());
+        }
+        template <typename VAL>
+        inline VAL max(const std::vector<VAL> &vals) {
+            return max(vals.data(), vals.data() + vals.size());
+        }
+        template <typename VAL>
+        inline VAL max(const View<VAL> &vals) {
+            return max(vals.begin(), vals.end());
+        }
+    }
+
+    /**
+     * @brief The output of an Incremental input policy: the latest value of
+     * each input, and which of them have changed
+     */
+    template <typename VAL>
+    struct Changes final {
+        /**
+         * @brief One value for each input, in the same order as Variadic
+         */
+        std::vector<VAL> values;
+
+        /**
+         * @brief The (ascending, unique) indices into values that have changed
+         * since the containing Node's last evaluation, including the positions
+         * inputs have been added at or moved to (by removing other inputs)
+         */
+        std::vector<std::size_t> changed;
+
+        inline bool operator==(const Changes &other) const {
+            return values == other.values && changed == other.changed;
+        }
+        inline bool operator!=(const Changes &other) const {
+            return !(*this == other);
+        }
+    };
+
+    /**
+     * @brief An input policy like Variadic, that also tells the Node's function
+     * which inputs have changed since it was last evaluated
+     * @details Lets functions like running sums or incremental fits do work
+     * proportional to the number of changed inputs rather than the total
+     * number of inputs. Storing a value in an input sets its dirty flag, and
+     * the first store after a read also pushes the input onto a lock-free
+     * stack of dirty inputs, so read() only visits the inputs that have
+     * changed. The Changes object is updated in-place if the Node's function
+     * didn't keep hold of the previous one, otherwise it's copied first.
+     *
+     * @tparam VAL The type of the value stored - must be be atomic
+     */
+    template <typename VAL>
+    class Incremental final : public Storeable<std::nullptr_t> {
+      public:
+        using input_type = std::nullptr_t;
+        using output_type = std::shared_ptr<const Changes<VAL>>;
+        using element_type = VAL;
+
+        /**
+         * @brief Should not be called directly, instead use new_input to get an
+         * Input to append values to
+         */
+        inline void store(input_type val) override { std::abort(); }
+
+        /**
+         * @brief Used by the Node to extract the latest values and the indices
+         * of the inputs that have changed
+         * @details Called by Node when the lock is held.
+         */
+        inline output_type read() {
+            Changes<VAL> &c = writable();
+            c.changed.swap(moved);
+            moved.clear();
+
+            Slot *slot = dirty.exchange(nullptr, std::memory_order_acq_rel);
+            while (slot != nullptr) {
+                Slot *next = slot->next.load(std::memory_order_relaxed);
+                // clear the flag before reading the value, so any later store
+                // pushes the slot again
+                slot->flagged.store(false, std::memory_order_seq_cst);
+                if (is_live(slot)) {
+                    c.values[slot->position] = slot->val.read();
+                    c.changed.push_back(slot->position);
+                }
+                slot = next;
+            }
+
+            std::sort(c.changed.begin(), c.changed.end());
+            c.changed.erase(std::unique(c.changed.begin(), c.changed.end()),
+                            c.changed.end());
+            while (!c.changed.empty() && c.changed.back() >= live.size())
+                c.changed.pop_back();
+            return out;
+        }
+
+        Incremental(input_type initial = nullptr)
+            : slots(), live(), unused(), moved(), dirty(nullptr),
+              out(std::make_shared<Changes<VAL>>()) {}
+        Incremental(const Incremental &other) = delete;
+
+      private:
+        /**
+         * @brief The storage for a single input
+         */
+        class Slot final : public Storeable<VAL> {
+          public:
+            inline void store(VAL v) override {
+                val.store(v);
+                if (flagged.exchange(true, std::memory_order_seq_cst))
+                    return; // already on the dirty stack
+
+                while (true) {
+                    Slot *snap = dirty.load(std::memory_order_acquire);
+                    next.store(snap, std::memory_order_relaxed);
+                    if (dirty.compare_exchange_weak(snap, this))
+                        return;
+                }
+            }
+
+            Slot(VAL initial, std::atomic<Slot *> &dirty)
+                : val(initial), position(0), flagged(false), next(nullptr),
+                  dirty(dirty) {}
+
+            Latest<VAL> val;
+
+            /**
+             * @brief This slot's index in Incremental::live
+             */
+            std::size_t position;
+
+            /**
+             * @brief Set when this slot's on the dirty stack
+             */
+            std::atomic<bool> flagged;
+            std::atomic<Slot *> next;
+            std::atomic<Slot *> &dirty;
+        };
+
+        /**
+         * @brief The storage for all the inputs, the same as Variadic
+         */
+        std::deque<Slot> slots;
+        std::vector<Slot *> live;
+        std::vector<Slot *> unused;
+
+        /**
+         * @brief Positions changed by adding or removing inputs since the last
+         * read
+         */
+        std::vector<std::size_t> moved;
+
+        /**
+         * @brief The head of the lock-free stack of slots stored to since the
+         * last read
+         */
+        std::atomic<Slot *> dirty;
+
+        std::shared_ptr<Changes<VAL>> out;
+
+        inline bool is_live(Slot *slot) const {
+            return slot->position < live.size() && live[slot->position] == slot;
+        }
+
+        /**
+         * @brief Get the output to update, copying it if the Node (or anything
+         * downstream) still holds the last one
+         */
+        inline Changes<VAL> &writable() {
+            if (out.use_count() != 1)
+                out = std::make_shared<Changes<VAL>>(*out);
+            return *out;
+        }
+
+        /**
+         * @brief Creates a new input at the end of the output values and
+         * returns it.
+         * @details Only call when the containing Node's lock is held.
+         */
+        inline Storeable<VAL> &add_input(VAL initial = {}) {
+            Slot *slot;
+            if (unused.empty()) {
+                slots.emplace_back(initial, dirty);
+                slot = &slots.back();
+            } else {
+                slot = unused.back();
+                unused.pop_back();
+                slot->val.store(initial);
+            }
+            slot->position = live.size();
+            live.push_back(slot);
+            writable().values.push_back(initial);
+            moved.push_back(slot->position);
+            return *slot;
+        }
+
+        /**
+         * @brief Removes an input created by add_input
+         * @details Only call when the containing Node's lock is held. The last
+         * input is moved into the removed input's position.
+         */
+        inline void remove_input(Storeable<VAL> *it) {
+            Slot *slot = static_cast<Slot *>(it);
+            if (!is_live(slot))
+                return; // already removed
+
+            Changes<VAL> &c = writable();
+            Slot *last = live.back();
+            live[slot->position] = last;
+            c.values[slot->position] = c.values.back();
+            last->position = slot->position;
+            live.pop_back();
+            c.values.pop_back();
+            moved.push_back(slot->position);
+
+            slot->val.store(VAL{});
+            unused.push_back(slot);
+        }
+
+        template <template <typename> class,
+                  template <template <typename> class, typename> class,
+                  typename, typename...>
+        friend class Node;
+    };
+
+    /**
+     * @brief Statistics for a single evaluation of the calculation graph.
+     */
+    struct Stats final {
+        /** @brief how many items were taken off the work queue */
+        uint64_t queued;
+        /** @brief how many Nodes were eval()'ed */
+        uint64_t worked;
+        /**
+         * @brief how many Nodes were added to this evaluation's heap
+         * multiple times (as they were dependent on more than one queued or
+         * dependent Node)
+         */
+        uint64_t duplicates;
+        /**
+         * @brief how many dependencies were pushed back on to the Graph's
+         * work_queue to be evaluted next time
+         */
+        uint64_t pushed_graph;
+        /**
+         * @brief how many dependencies were pushed onto this evaluation's
+         * work heap to be evaluated in topological order
+         */
+        uint64_t pushed_heap;
+        /**
+         * @brief how many Nodes taken off the work queue weren't eval()'ed as
+         * they had already been eval()'ed (via the heap) since they were last
+         * scheduled
+         */
+        uint64_t redundant;
+        /**
+         * @brief how many Nodes were put back on the Graph's work_queue
+         * unevaluated as their lane had used up its time budget
+         */
+        uint64_t deferred;
+
+        operator std::string() const {
+            std::ostringstream out;
+            out << "queued: " << queued;
+            out << ", worked: " << worked;
+            out << ", duplicates: " << duplicates;
+            out << ", pushed_graph: " << pushed_graph;
+            out << ", pushed_heap: " << pushed_heap;
+            out << ", redundant: " << redundant;
+            out << ", deferred: " << deferred;
+            return out.str();
+        }
+    };
+
+    /**
+     * @brief A helper member to zero out a Stats object
+     */
+    static const struct Stats EmptyStats {};
+
+    /**
+     * @brief Statistics for a single evaluation of the calculation graph,
+     * including distributions as well as totals
+     * @details Histogram bucket 0 counts zeros, and bucket i (for i > 0)
+     * counts values in [2^(i-1), 2^i), with the last bucket also counting
+     * anything bigger.
+     */
+    struct FullStats final {
+        static const std::size_t BUCKETS = 32;
+
+        /** @brief the same totals as a Stats object */
+        struct Stats totals;
+        /**
+         * @brief the number of Work items left on the evaluation's heap each
+         * time one was taken off it
+         */
+        uint64_t heap_depth[BUCKETS];
+        /**
+         * @brief the number of Work items taken off the Graph's work_queue at
+         * once
+         */
+        uint64_t drained[BUCKETS];
+
+        /**
+         * @brief The histogram bucket a value goes in
+         */
+        static inline std::size_t bucket(uint64_t value) {
+            std::size_t b = 0;
+            while (value && b < BUCKETS - 1) {
+                value >>= 1;
+                ++b;
+            }
+            return b;
+        }
+
+        operator std::string() const {
+            std::ostringstream out;
+            out << static_cast<std::string>(totals);
+            out << ", heap_depth: [";
+            for (std::size_t i = 0; i < BUCKETS; ++i)
+                out << (i ? " " : "") << heap_depth[i];
+            out << "], drained: [";
+            for (std::size_t i = 0; i < BUCKETS; ++i)
+                out << (i ? " " : "") << drained[i];
+            out << "]";
+            return out.str();
+        }
+    };
+
+    /**
+     * @brief The state used for a single evalution of a Graph.
+     */
+    class WorkState final {
+      public:
+        /**
+         * @brief add the given work item to the heap (to be processed later
+         * this evalution) or the Graph's work_queue (to be processed next
+         * evalution)
+         * @details Either way the Work is marked dirty, so if it's also still
+         * on the Graph's work_queue from earlier, the copy on the work_queue
+         * won't be needlessly eval()'ed a second time.
+         */
+        void add_to_queue(Work &work);
+
+        /**
+         * @brief Start collecting the Work items passed to add_to_queue, so
+         * they can be added to the heap and the Graph's work_queue in bulk
+         * @details Used when propagating a value to many dependents. Calls
+         * can be nested; nothing's added until the outermost end_fanout.
+         */
+        inline void begin_fanout() { ++fanout_depth; }
+
+        /**
+         * @brief Add the Work items collected since begin_fanout to the heap
+         * (fencing their dirty flags once for all of them) and splice any for
+         * the next evaluation onto the Graph's work_queue with a single
+         * compare-and-swap
+         */
+        void end_fanout();
+
+        /**
+         * @brief Record that a Lazy Node's result is newly stale, so
+         * Graph::pull will recalculate it
+         */
+        void invalidated(Work &work);
 
         /**
-         * @brief Used by the Node to extract the current list of latest values
-         * from the inputs.
-         * @details Called by Node when the lock is held, so accesses the inputs
-         * vector in a thread-safe manner.
-         * @returns A non-null (but possibly empty) std::vector, with one value
-         * for each input created by new_input().
+         * @brief If the propagation policy of the Work being evaluated has
+         * held back a value it wants to pass on later (e.g. Throttle), ask
+         * the Graph to re-evaluate the Work then
+         * @details Only policies with a retry_at method are asked.
          */
-        inline output_type read() {
-            auto out = output_type(new std::vector<VAL>());
-            for (auto i = inputs.begin(); i != inputs.end(); ++i) {
-                out->push_back(i->read());
-            }
-            return out;
+        template <typename POLICY>
+        inline void retry(POLICY &policy) {
+            retry(policy, 0);
         }
 
-        Variadic(input_type initial = nullptr) noexcept : inputs() {}
-        Variadic(const Variadic &other) = delete;
-
       private:
+        using time_point = std::chrono::steady_clock::time_point;
+        template <typename POLICY>
+        inline auto retry(POLICY &policy, int)
+            -> decltype(policy.retry_at(std::declval<time_point &>()), void()) {
+            time_point when;
+            if (policy.retry_at(when))
+                defer(when);
+        }
+        template <typename POLICY>
+        inline void retry(POLICY &, long) {}
+
         /**
-         * @brief The Inputs, guarded by the containing Node's lock
-         * @details A std::forward_list, not a std::vector as we can't move the
-         * Latest objects (as std:atomics aren't copy-constructible), so we
-         * can't resize a vector.
+         * @brief Re-evaluate the current Work item at the given time
          */
-        std::forward_list<Latest<VAL>> inputs;
+        void defer(std::chrono::steady_clock::time_point when);
 
         /**
-         * @brief Creates a new input for the output vector and returns it.
-         * @details Always created at the end. Only call when the containing
-         * Node's lock is held.
+         * @brief The Work item we're currently evaluating, if any
          */
-        inline Latest<VAL> &add_input(VAL initial = {}) {
-            auto before_end = inputs.before_begin();
-            for (auto &_ : inputs)
-                ++before_end;
-            inputs.emplace_after(before_end, initial);
-            ++before_end; // point to the new element
-            return *before_end;
-        }
+        Work *current;
 
         /**
-         * @brief Removes an input created by add_input from the list
-         * @details Only call when the containing Node's lock is held.
+         * @brief the Work items to process this evaluation, kept as a heap
+         * (using std::push_heap and std::pop_heap) so the lowest Work::id is
+         * at the front
+         * @details The Graph reuses the same WorkState for each evaluation, so
+         * once this vector has grown to fit the largest evaluation so far
+         * Graph::operator() won't allocate any memory for it.
          */
-        inline void remove_input(Storeable<VAL> *it) {
-            // Latest objects don't have equality methods, so just check if the
-            // pointers match.
-            inputs.remove_if([it](const Latest<VAL> &val) {
-                return std::addressof(val) == it;
-            });
-        }
-
+        std::vector<Work *> q;
+        Graph &g;
+        /**
+         * @brief What happened during this evaluation
+         * @details Always counted (it's cheaper than checking whether anyone
+         * wants them) and copied out by Graph::operator() if asked for.
+         */
+        struct Stats counts;
+        friend class Graph;
+        friend void evaluate_in_parallel(Graph &, std::atomic<bool> &,
+                                         unsigned);
         template <template <typename> class,
                   template <template <typename> class, typename> class,
                   typename, typename...>
         friend class Node;
-    };
+        /**
+         * @brief The Work::rank of the Work item we're currently processing
+         */
+        uint64_t current_rank;
 
-    /**
-     * @brief The state used for a single evalution of a Graph.
-     */
-    class WorkState final {
-      public:
         /**
-         * @brief add the given work item to the heap (to be processed later
-         * this evalution) or the Graph's work_queue (to be processed next
-         * evalution)
-         *
-         * @todo if we decide to push the Work onto the heap, we could "steal"
-         * it from the Graph's work queue if it's on there too, so we don't
-         * needlessly evaluate it a second time.
+         * @brief How many begin_fanout calls haven't been ended yet
          */
-        void add_to_queue(Work &work);
+        unsigned fanout_depth;
 
-      private:
         /**
-         * @brief the Work items to process this evaluation
-         *
-         * @todo use a fixed-size heap, and push any overflowing Work items back
-         * on the Graph's work queue to evaluate later.
+         * @brief Work items for the heap collected during a fan-out
+         * @details Reused, like q.
          */
-        std::priority_queue<Work *, std::vector<Work *>, WorkQueueCmp> q;
-        Graph &g;
-        struct Stats *stats;
-        friend class Graph;
+        std::vector<Work *> pending;
+
+        /**
+         * @brief Work items for the Graph's work_queue collected during a
+         * fan-out, claimed and chained together as in a Batch
+         */
+        Work *chain_first;
+        Work *chain_tail;
+
+        WorkState(Graph &g)
+            : current(nullptr), g(g), counts(), current_rank(0),
+              fanout_depth(0), chain_first(nullptr), chain_tail(nullptr) {
+            q.reserve(initial_capacity);
+        }
+
+        /**
+         * @brief How many Work items we reserve heap space for up-front
+         */
+        static const std::size_t initial_capacity = 64;
+
+        /**
+         * @brief Add a Work item to the heap
+         */
+        void push(Work *w);
+
         /**
-         * @brief The Work::id of the Work item we're currently processing
+         * @brief Remove the Work item with the lowest id from the heap,
+         * discarding (and releasing) any duplicates of it
+         * @returns nullptr if the heap was empty
          */
-        uint32_t current_id;
-        WorkState(Graph &g, struct Stats *stats) : g(g), stats(stats) {}
+        Work *pop();
     };
 
     namespace flags {
@@ -366,6 +2179,47 @@ namespace calcgraph {
         static const uint32_t DONT_SCHEDULE = 0;
     }
 
+    /**
+     * @brief A snapshot of the metrics collected for a single Work item
+     * @details Only collected if the library and everything including this
+     * header are compiled with CALCGRAPH_METRICS defined (e.g. by configuring
+     * cmake with -D WITH_METRICS=ON). Times are in nanoseconds.
+     */
+    struct NodeMetrics final {
+        /** @brief the Work::id of the Work item */
+        uint32_t id;
+        /** @brief how many times the Work item was eval()'ed */
+        uint64_t evaluations;
+        /** @brief the total time spent in the Node's function */
+        uint64_t fn_nanos;
+        /** @brief the longest single call to the Node's function */
+        uint64_t max_fn_nanos;
+        /**
+         * @brief the total time between the Work item first being scheduled
+         * and it being eval()'ed
+         */
+        uint64_t lag_nanos;
+        /** @brief the longest single schedule-to-eval lag */
+        uint64_t max_lag_nanos;
+        /**
+         * @brief how many times eval() found the Work item already locked by
+         * another thread, and so put it back on the queue
+         */
+        uint64_t contended;
+
+        operator std::string() const {
+            std::ostringstream out;
+            out << "id: " << id;
+            out << ", evaluations: " << evaluations;
+            out << ", fn_nanos: " << fn_nanos;
+            out << ", max_fn_nanos: " << max_fn_nanos;
+            out << ", lag_nanos: " << lag_nanos;
+            out << ", max_lag_nanos: " << max_lag_nanos;
+            out << ", contended: " << contended;
+            return out.str();
+        }
+    };
+
     /**
      * @brief A building block of the graph; either a raw input or code to
      * be evaluated.
@@ -375,9 +2229,21 @@ namespace calcgraph {
         /**
          * @brief The node's unique id
          * @details Uniqueness is per Graph, and this id is set by the Graph
-         * object that created the Work.
+         * object that created the Work (and only changed by Graph::compact).
+         */
+        uint32_t id;
+
+        /**
+         * @brief The priority lane this Work is evaluated in
          */
-        const uint32_t id;
+        inline Priority priority() const { return lane; }
+
+        /**
+         * @brief The order Work is evaluated in: by lane, then by id
+         */
+        constexpr uint64_t rank() const {
+            return (static_cast<uint64_t>(lane) << 32) | id;
+        }
 
         virtual ~Work() {}
 
@@ -393,16 +2259,46 @@ namespace calcgraph {
          */
         virtual void eval(WorkState &) = 0;
 
+        /**
+         * @brief If this is a Lazy Node whose result is stale, recalculate it
+         * @details Does nothing for other Work.
+         */
+        virtual void refresh(Graph &) {}
+
+        /**
+         * @brief Append the Work items this one schedules when it passes
+         * values on
+         * @details Used by Graph::compact and evaluate_in_parallel to walk the
+         * Graph; Work that isn't a Node has no dependents, and connections
+         * that don't schedule anything (e.g. from a Weak Node) aren't
+         * included.
+         */
+        virtual void collect_dependents(std::vector<Work *> &) {}
+
       protected:
-        Work(uint32_t id) : id(id), refcount(0), next(0) {}
+        Work(uint32_t id)
+            : id(id), lane(Priority::NORMAL), refcount(0), next(0),
+              dirty(false) {}
         Work(const Work &) = delete;
         Work &operator=(const Work &) = delete;
 
         friend class WorkState;
+        friend class Graph;
+        friend class Batch;
+        friend void evaluate_in_parallel(Graph &, std::atomic<bool> &,
+                                         unsigned);
         template <typename>
         friend class KeyedOutput;
+        template <template <typename> class,
+                  template <template <typename> class, typename> class,
+                  class...>
+        friend class NodeBuilder;
+        friend class Checkpoint;
 
       private:
+        // set by NodeBuilder before the Work is first scheduled
+        Priority lane;
+
         // for boost's intrinsic_ptr
         std::atomic_uint_fast16_t refcount;
         friend inline void intrusive_ptr_add_ref(Work *w) { ++w->refcount; }
@@ -412,6 +2308,23 @@ namespace calcgraph {
             }
         }
 
+      public:
+        /**
+         * @brief Work objects are allocated with a header so they can be freed
+         * by intrusive_ptr_release regardless of whether they came from the
+         * heap or a Graph's Arena
+         */
+        static void *operator new(std::size_t size) {
+            return Arena::allocate_unpooled(size);
+        }
+        static void *operator new(std::size_t size, Arena &arena) {
+            return arena.allocate(size);
+        }
+        static void operator delete(void *p) { Arena::deallocate(p); }
+        static void operator delete(void *p, Arena &) { Arena::deallocate(p); }
+
+      private:
+
         /**
          * @page worklocking Locking a Work object
          *
@@ -430,6 +2343,26 @@ namespace calcgraph {
          */
         std::atomic<std::uintptr_t> next;
 
+        /**
+         * @brief Set whenever this Work is scheduled (on either the Graph's
+         * work_queue or an evaluation's heap), and cleared just before it's
+         * eval()'ed
+         * @details If a Work item is on the Graph's work_queue and is also
+         * pushed onto the heap and eval()'ed in the same evaluation, it'll come
+         * off the work_queue next evaluation with this flag clear - it has
+         * already seen all the inputs that caused it to be scheduled, so we
+         * can skip eval()'ing it a second time.
+         */
+        std::atomic<bool> dirty;
+
+        /**
+         * @brief Clear the dirty flag
+         * @returns true if the flag was set, so this Work should be eval()'ed
+         */
+        inline bool clean() {
+            return dirty.exchange(false, std::memory_order_seq_cst);
+        }
+
       public:
         /**
          * @brief Fetch and clear the Work item's next-pointer
@@ -446,6 +2379,18 @@ namespace calcgraph {
             return reinterpret_cast<Work *>(p & ~flags::LOCK);
         }
 
+        /**
+         * @brief Mark this Work as scheduled, and point it at the given Work
+         * rather than the head of the Graph's work_queue
+         * @details Used by Batch to build up a chain of Work items that it
+         * then adds to the work_queue in one go. Like schedule, this is a
+         * no-op if the Work is already on a work_queue (or another Batch's
+         * chain).
+         * @returns true if the Work was claimed, and so now holds a reference
+         * to itself that the work_queue will release when it's eval()'ed
+         */
+        bool claim(Work *successor);
+
       protected:
         /**
          * @brief Tries to acquire the Work's exclusive lock
@@ -479,6 +2424,111 @@ namespace calcgraph {
         void release() {
             next.fetch_and(~flags::LOCK, std::memory_order_release);
         }
+
+        /**
+         * @brief Metrics hooks, which compile away to nothing unless
+         * CALCGRAPH_METRICS is defined
+         * @details eval_started and eval_finished must only be called with the
+         * lock held, so the counters only they update have a single writer.
+         */
+        inline void metrics_scheduled() {
+#ifdef CALCGRAPH_METRICS
+            if (counters->scheduled_at.load(std::memory_order_relaxed) == 0) {
+                uint64_t expected = 0;
+                counters->scheduled_at.compare_exchange_strong(
+                    expected, metrics_now(), std::memory_order_relaxed);
+            }
+#endif
+        }
+        inline void metrics_contended() {
+#ifdef CALCGRAPH_METRICS
+            counters->contended.fetch_add(1, std::memory_order_relaxed);
+#endif
+        }
+        inline uint64_t metrics_started() {
+#ifdef CALCGRAPH_METRICS
+            uint64_t now = metrics_now();
+            uint64_t since =
+                counters->scheduled_at.exchange(0, std::memory_order_relaxed);
+            if (since != 0 && since < now)
+                Counters::add(counters->lag_nanos, counters->max_lag_nanos,
+                              now - since);
+            return now;
+#else
+            return 0;
+#endif
+        }
+#ifdef CALCGRAPH_METRICS
+        inline void metrics_finished(uint64_t started) {
+            Counters::add(counters->fn_nanos, counters->max_fn_nanos,
+                          metrics_now() - started);
+            counters->evaluations.store(
+                counters->evaluations.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+        }
+#else
+        inline void metrics_finished(uint64_t /*started*/) {}
+#endif
+
+#ifdef CALCGRAPH_METRICS
+      private:
+        /**
+         * @brief The live metrics of a Work item
+         * @details Held by a std::shared_ptr so the Graph can keep weak
+         * references to them that outlive the Work item.
+         */
+        struct Counters final {
+            std::atomic<uint32_t> id;
+            std::atomic<uint64_t> evaluations;
+            std::atomic<uint64_t> fn_nanos;
+            std::atomic<uint64_t> max_fn_nanos;
+            std::atomic<uint64_t> lag_nanos;
+            std::atomic<uint64_t> max_lag_nanos;
+            std::atomic<uint64_t> contended;
+            /**
+             * @brief When this Work was first scheduled since it was last
+             * eval()'ed, or zero if it isn't scheduled
+             */
+            std::atomic<uint64_t> scheduled_at;
+
+            Counters(uint32_t id)
+                : id(id), evaluations(0), fn_nanos(0), max_fn_nanos(0),
+                  lag_nanos(0), max_lag_nanos(0), contended(0),
+                  scheduled_at(0) {}
+
+            /**
+             * @brief Add to a total and update a maximum; only safe with a
+             * single writer
+             */
+            static inline void add(std::atomic<uint64_t> &total,
+                                   std::atomic<uint64_t> &max,
+                                   uint64_t value) {
+                total.store(total.load(std::memory_order_relaxed) + value,
+                            std::memory_order_relaxed);
+                if (value > max.load(std::memory_order_relaxed))
+                    max.store(value, std::memory_order_relaxed);
+            }
+
+            NodeMetrics snapshot() const {
+                return NodeMetrics{
+                    id.load(std::memory_order_relaxed),
+                    evaluations.load(std::memory_order_relaxed),
+                    fn_nanos.load(std::memory_order_relaxed),
+                    max_fn_nanos.load(std::memory_order_relaxed),
+                    lag_nanos.load(std::memory_order_relaxed),
+                    max_lag_nanos.load(std::memory_order_relaxed),
+                    contended.load(std::memory_order_relaxed)};
+            }
+        };
+
+        std::shared_ptr<Counters> counters = std::make_shared<Counters>(id);
+
+        static inline uint64_t metrics_now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+#endif
     };
 
     /**
@@ -493,6 +2543,34 @@ namespace calcgraph {
         inline constexpr bool notify() const { return true; }
     };
 
+    /**
+     * @brief Whether two values are different, as used by OnChange
+     * @details Defaults to operator!=.
+     */
+    template <typename VAL>
+    inline bool differs(const VAL &a, const VAL &b) {
+        return a != b;
+    }
+
+    /**
+     * @brief Compares std::vectors of arithmetic values bitwise, with a
+     * single (vectorized) memcmp rather than element by element
+     * @details So unlike operator!=, a NaN is the same as an identical NaN,
+     * but 0.0 differs from -0.0. std::vector<bool> is bit-packed with no
+     * data(), and a long double has padding bytes (whose values are
+     * indeterminate), so both fall back to operator!=.
+     */
+    template <typename VAL>
+    inline std::enable_if_t<std::is_arithmetic<VAL>::value &&
+                                !std::is_same<VAL, bool>::value &&
+                                !std::is_same<VAL, long double>::value,
+                            bool>
+    differs(const std::vector<VAL> &a, const std::vector<VAL> &b) {
+        return a.size() != b.size() ||
+               (!a.empty() &&
+                std::memcmp(a.data(), b.data(), a.size() * sizeof(VAL)) != 0);
+    }
+
     /**
      * @brief A propagation policy that recalculates downstream dependencies
      * only if the Node's output changes (according to the != operator)
@@ -512,6 +2590,20 @@ namespace calcgraph {
             return last.exchange(latest) != latest;
         }
 
+        /**
+         * @brief Save and restore the last value, for a Checkpoint
+         */
+        template <typename V = RET,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline void save(std::string &out) {
+            last.save(out);
+        }
+        template <typename V = RET,
+                  typename = std::enable_if_t<checkpointable<V>::value>>
+        inline bool restore(const char *first, const char *end, bool apply) {
+            return last.restore(first, end, apply);
+        }
+
       private:
         Latest<RET> last;
     };
@@ -526,7 +2618,7 @@ namespace calcgraph {
         inline bool push_value(std::shared_ptr<RET> latest) {
             auto previous = last.exchange(latest);
             if (latest && previous)
-                return *latest != *previous;
+                return differs(*latest, *previous);
             else
                 return latest != previous;
         }
@@ -548,6 +2640,133 @@ namespace calcgraph {
         inline constexpr bool push_value(RET latest) { return true; }
     };
 
+    /**
+     * @brief A propagation policy for Nodes that are only evaluated on demand
+     * @details When an input of a Node with this policy changes, the Node
+     * just marks its cached result stale rather than calling its function.
+     * The function is only called (and the result cached and passed on to
+     * any connected Inputs) when the value's asked for with Node::get, or
+     * by Graph::pull. Useful for expensive Nodes whose results are only read
+     * occasionally, e.g. at snapshot time.
+     * @tparam RET The type of the values calcuated by the Node this policy
+     * applies to
+     */
+    template <typename RET>
+    struct Lazy final {
+        inline constexpr bool notify() const { return true; }
+        inline constexpr bool push_value(RET latest) { return true; }
+    };
+
+    /**
+     * @brief Whether a Node with the given propagation policy is only
+     * evaluated on demand
+     */
+    template <typename POLICY>
+    struct is_lazy final : std::false_type {};
+    template <typename RET>
+    struct is_lazy<Lazy<RET>> final : std::true_type {};
+
+    /**
+     * @brief A propagation policy that passes on at most one value per
+     * interval, conflating the rest
+     * @details The first value in each interval is passed on straight away.
+     * If later values arrive in the same interval, the Node is re-evaluated
+     * when the interval ends (via Graph's timers, which are checked on each
+     * evaluation), and the value it calculates then - from its latest inputs
+     * - is passed on and starts the next interval. Intended for Nodes whose
+     * inputs use the Latest policy, as the values held back aren't kept.
+     * @tparam MICROS The length of the interval, in microseconds
+     */
+    template <uint64_t MICROS>
+    struct Throttle final {
+        template <typename RET>
+        struct type final {
+            inline constexpr bool notify() const { return true; }
+            inline bool push_value(const RET &) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= window_end) {
+                    window_end = now + std::chrono::microseconds(MICROS);
+                    armed = false;
+                    return true;
+                }
+                return false;
+            }
+
+            /**
+             * @brief When to re-evaluate the Node to pass on a held-back
+             * value, the first time one's held back in an interval
+             * @returns false if a re-evaluation has already been requested
+             */
+            inline bool retry_at(std::chrono::steady_clock::time_point &when) {
+                if (armed)
+                    return false;
+                armed = true;
+                when = window_end;
+                return true;
+            }
+
+          private:
+            std::chrono::steady_clock::time_point window_end;
+            bool armed = false;
+        };
+    };
+
+    /**
+     * @brief A propagation policy that only passes on values that differ from
+     * the last value passed on by more than a threshold
+     * @details Small moves accumulate, so a value that drifts slowly is
+     * still passed on once it's moved far enough from the last value passed
+     * on. The first value is always passed on. The threshold is absolute,
+     * in the same units as the value. Integral values are compared by their
+     * distance as an unsigned number, so values far apart can't overflow,
+     * and need a whole-number threshold.
+     * @tparam EPSILON The threshold, as a std::ratio
+     */
+    template <typename EPSILON>
+    struct Tolerance final {
+        template <typename RET>
+        struct type final {
+            static_assert(!std::is_integral<RET>::value ||
+                              EPSILON::num % EPSILON::den == 0,
+                          "an integral Tolerance needs a whole threshold");
+
+            inline constexpr bool notify() const { return true; }
+            inline bool push_value(const RET &latest) {
+                if (seen && !moved(latest, std::is_integral<RET>{}))
+                    return false;
+                last = latest;
+                seen = true;
+                return true;
+            }
+
+          private:
+            inline bool moved(const RET &latest, std::true_type) const {
+                using distance = std::make_unsigned_t<RET>;
+                static const distance epsilon =
+                    static_cast<distance>(EPSILON::num / EPSILON::den);
+                // unsigned subtraction is modular, so this is the exact
+                // distance even if the signed difference would overflow
+                return latest > last ? static_cast<distance>(latest) -
+                                               static_cast<distance>(last) >
+                                           epsilon
+                                     : static_cast<distance>(last) -
+                                               static_cast<distance>(latest) >
+                                           epsilon;
+            }
+            inline bool moved(const RET &latest, std::false_type) const {
+                static const RET epsilon =
+                    static_cast<RET>(EPSILON::num) / EPSILON::den;
+                // written so a NaN is always passed on
+                return !(latest > last ? latest - last <= epsilon
+                                       : last - latest <= epsilon);
+            }
+
+          private:
+            RET last{};
+            bool seen = false;
+        };
+    };
+
     /**
      * @brief A concept for "something you can connect an Input to"
      * @tparam RET The type of the values consumed (and so the type of values
@@ -653,8 +2872,16 @@ namespace calcgraph {
          * propagation policy) and schedule them (also if allowed).
          */
         inline void propagate(RET &&val, WorkState &ws) {
-            if (!propagation_policy.push_value(val))
+            if (!propagation_policy.push_value(val)) {
+                ws.retry(propagation_policy);
                 return;
+            }
+
+            // schedule many dependents in bulk, rather than one heap push or
+            // work_queue compare-and-swap each
+            bool fanout = propagation_policy.notify() && dependents.size() > 1;
+            if (fanout)
+                ws.begin_fanout();
 
             // accessing i by index as embedded Inputs may modify the list,
             // invalidating any iterators
@@ -664,16 +2891,20 @@ namespace calcgraph {
                     ws.add_to_queue(*dependents[i].ref);
                 }
             }
+
+            if (fanout)
+                ws.end_fanout();
         }
 
         /**
          * @brief Attach the given function to an Input and add that Input to
          *the list.
+         * @details The Input's allocated from the given Arena, like a Node.
          * @see Node::embed
          *
          * @return The created Input, which you can pass to disconnect.
          */
-        inline Input<output_type> embed(embed_type &&fn) {
+        inline Input<output_type> embed(Arena &arena, embed_type &&fn) {
             class Embed final : public Storeable<output_type>, public Work {
 
                 embed_type fn;
@@ -690,10 +2921,38 @@ namespace calcgraph {
                 inline void store(output_type v) { fn(v, *output); }
                 void eval(WorkState &) { std::abort(); }
             };
-            auto ret = new Embed(std::move(fn), this);
+            auto ret = new (arena) Embed(std::move(fn), this);
             return Input<output_type>(*ret, ret);
         }
 
+        /**
+         * @brief Append the Work items of the connected Inputs that this
+         * output schedules
+         * @details Nothing is appended if the propagation policy doesn't
+         * notify its dependents (e.g. Weak), as those edges are how a graph
+         * breaks its cycles and don't order anything.
+         */
+        inline void collect_dependents(std::vector<Work *> &out) const {
+            if (!propagation_policy.notify())
+                return;
+            for (auto &dependent : dependents) {
+                if (dependent.ref)
+                    out.push_back(dependent.ref.get());
+            }
+        }
+
+        /**
+         * @brief Save and restore the propagation policy's state (if it has
+         * any), for a Checkpoint
+         */
+        inline void save(std::string &out) {
+            save_part(propagation_policy, out);
+        }
+        inline bool restore(const char *first, const char *last, bool apply) {
+            return restore_part(propagation_policy, first, last, apply) &&
+                   first == last;
+        }
+
         SingleList() noexcept : dependents(), propagation_policy() {}
 
       private:
@@ -764,9 +3023,14 @@ namespace calcgraph {
                 return output.keyed_output(key, ref);
             }
 
+            inline void collect_dependents(std::vector<Work *> &out) const {
+                output.collect_dependents(out);
+            }
+
             inline Input<output_type> embed(
+                Arena &arena,
                 const std::function<void(output_type, interface_type &)> &&fn) {
-                return output.embed(std::move(fn));
+                return output.embed(arena, std::move(fn));
             }
 
           private:
@@ -845,16 +3109,192 @@ namespace calcgraph {
                     boost::intrusive_ptr<Work> ref) noexcept
             : delegate(&delegate),
               ref(ref) {}
-        template <template <typename> class, typename>
-        friend class Demultiplexed;
+        template <template <typename, typename> class,
+                  template <typename> class, typename>
+        friend class BasicDemultiplexed;
+
+        Connectable<value_type> *delegate;
+
+        /**
+         * To make sure the containing Node isn't destroyed while we're
+         * still alive
+         */
+        boost::intrusive_ptr<Work> ref;
+    };
+
+    /**
+     * @brief A key index for Demultiplexed that uses a flat, open-addressing
+     * hash table
+     * @details Each slot of the table holds a copy of the key and a pointer to
+     * the mapped value, so a lookup usually only touches one cache line of the
+     * table. The mapped values themselves live in a std::deque, so they never
+     * move (KeyedOutputs point to them). Lookups don't allocate, and the table
+     * doubles in size (rehashing the keys, but not moving the values) when
+     * it's half full. Entries are never removed.
+     *
+     * @tparam KEY The key type, which must be default-constructible, copyable,
+     * equality-comparable and hashable with std::hash
+     * @tparam MAPPED The type of value associated with each key
+     */
+    template <typename KEY, typename MAPPED>
+    class FlatIndex final {
+      public:
+        /**
+         * @returns The value associated with the key, or nullptr if there
+         * isn't one
+         */
+        inline MAPPED *find(const KEY &key) const {
+            if (slots.empty())
+                return nullptr;
+            for (std::size_t i = home(key);; i = (i + 1) & mask()) {
+                const Slot &slot = slots[i];
+                if (!slot.value || slot.key == key)
+                    return slot.value;
+            }
+        }
+
+        /**
+         * @returns The value associated with the key, default-constructing
+         * one if it isn't already in the index
+         */
+        MAPPED &emplace(const KEY &key) {
+            MAPPED *found = find(key);
+            if (found)
+                return *found;
+
+            if ((values.size() + 1) * 2 > slots.size())
+                grow();
+
+            values.emplace_back(std::piecewise_construct,
+                                std::forward_as_tuple(key),
+                                std::forward_as_tuple());
+            insert(key, &values.back().second);
+            return values.back().second;
+        }
+
+        /**
+         * @brief Call fn with each value in the index, in insertion order
+         */
+        template <typename FN>
+        inline void for_each(FN fn) const {
+            for (auto &entry : values) {
+                fn(entry.second);
+            }
+        }
+
+        FlatIndex() : slots(), values() {}
+        FlatIndex(const FlatIndex &other) = delete;
+
+      private:
+        struct Slot final {
+            KEY key;
+            /**
+             * @brief nullptr if this slot is empty
+             */
+            MAPPED *value;
+        };
+
+        std::vector<Slot> slots;
+        std::deque<std::pair<const KEY, MAPPED>> values;
+
+        inline std::size_t mask() const { return slots.size() - 1; }
+
+        /**
+         * @brief Where to start looking for the key
+         * @details Mixes the bits of the std::hash (which is the identity for
+         * integers in most standard libraries) using Fibonacci hashing.
+         */
+        inline std::size_t home(const KEY &key) const {
+            uint64_t h = static_cast<uint64_t>(std::hash<KEY>()(key));
+            return static_cast<std::size_t>((h * 0x9E3779B97F4A7C15ull) >>
+                                            32) &
+                   mask();
+        }
+
+        void insert(const KEY &key, MAPPED *value) {
+            std::size_t i = home(key);
+            while (slots[i].value) {
+                i = (i + 1) & mask();
+            }
+            slots[i].key = key;
+            slots[i].value = value;
+        }
+
+        void grow() {
+            slots.assign(slots.empty() ? 16 : slots.size() * 2, Slot{KEY(),
+                                                                     nullptr});
+            for (auto &entry : values) {
+                insert(entry.first, &entry.second);
+            }
+        }
+    };
+
+    /**
+     * @brief A key index for Demultiplexed that uses the key itself as an
+     * index into a table of pointers
+     * @details Lookups are a bounds check and an array access. The table is
+     * sized to fit the largest key seen so far, so keys are limited to
+     * unsigned integers of at most 16 bits (e.g. a uint8_t), which caps the
+     * table at 65536 pointers whatever keys arrive. Like FlatIndex, the
+     * mapped values live in a std::deque so never move.
+     *
+     * @tparam KEY The (unsigned, 8- or 16-bit) key type
+     * @tparam MAPPED The type of value associated with each key
+     */
+    template <typename KEY, typename MAPPED>
+    class DenseIndex final {
+        static_assert(std::is_integral<KEY>::value &&
+                          std::is_unsigned<KEY>::value && sizeof(KEY) <= 2,
+                      "DenseIndex keys must be unsigned integers of at most "
+                      "16 bits");
+
+      public:
+        /**
+         * @returns The value associated with the key, or nullptr if there
+         * isn't one
+         */
+        inline MAPPED *find(const KEY &key) const {
+            std::size_t i = index(key);
+            return i < table.size() ? table[i] : nullptr;
+        }
 
-        Connectable<value_type> *delegate;
+        /**
+         * @returns The value associated with the key, default-constructing
+         * one if it isn't already in the index
+         */
+        MAPPED &emplace(const KEY &key) {
+            MAPPED *found = find(key);
+            if (found)
+                return *found;
+
+            std::size_t i = index(key);
+            if (i >= table.size())
+                table.resize(i + 1, nullptr);
+            values.emplace_back();
+            table[i] = &values.back();
+            return values.back();
+        }
 
         /**
-         * To make sure the containing Node isn't destroyed while we're
-         * still alive
+         * @brief Call fn with each value in the index, in insertion order
          */
-        boost::intrusive_ptr<Work> ref;
+        template <typename FN>
+        inline void for_each(FN fn) const {
+            for (auto &value : values) {
+                fn(value);
+            }
+        }
+
+        DenseIndex() : table(), values() {}
+        DenseIndex(const DenseIndex &other) = delete;
+
+      private:
+        std::vector<MAPPED *> table;
+        std::deque<MAPPED> values;
+
+        static inline std::size_t index(const KEY &key) {
+            return static_cast<std::size_t>(key);
+        }
     };
 
     /**
@@ -869,11 +3309,14 @@ namespace calcgraph {
      *calculation graph to deal with new keys you won't miss values sent while
      *this node is being eval()'ed.
      *
+     * @tparam INDEX How to look up the outputs for each key, e.g. FlatIndex or
+     *DenseIndex
      * @tparam RET A templatized std::pair, where the left side is the key
      *and the right side is the value to be passed to downstream nodes.
      */
-    template <template <typename> class PROPAGATE, typename RET>
-    class Demultiplexed final : public Connectable<std::shared_ptr<RET>> {
+    template <template <typename, typename> class INDEX,
+              template <typename> class PROPAGATE, typename RET>
+    class BasicDemultiplexed final : public Connectable<std::shared_ptr<RET>> {
       public:
         /**
          * @brief The type of values that aren't associated with a key
@@ -911,12 +3354,15 @@ namespace calcgraph {
          */
         inline void propagate(RET &&val, WorkState &ws) {
             auto found = keyed.find(val.first);
-            if (found == keyed.end()) {
-                // pass the whole thing to the unkeyed output
-                output_type on_heap(new RET(val));
+            if (!found) {
+                // pass the whole thing to the unkeyed output. The pair and
+                // the shared_ptr's control block are allocated together from
+                // a Pool, so a burst of unknown keys doesn't call malloc.
+                output_type on_heap = std::allocate_shared<RET>(
+                    PoolAllocator<RET>(), std::move(val));
                 unkeyed.propagate(std::move(on_heap), ws);
             } else {
-                found->second.propagate(std::move(val.second), ws);
+                found->propagate(std::move(val.second), ws);
             }
         }
 
@@ -936,25 +3382,25 @@ namespace calcgraph {
         /**
          * @brief Attach the given function to an Input and add that Input to
          *the "unkeyed" list.
+         * @details The Input's allocated from the given Arena, like a Node.
          * @see Node::embed
          *
          * @return The created Input, which you can pass to disconnect.
          */
-        inline Input<output_type> embed(embed_type &&fn) {
+        inline Input<output_type> embed(Arena &arena, embed_type &&fn) {
             class Embed final : public Storeable<output_type>,
                                 public Work,
                                 public interface_type {
 
                 embed_type fn;
-                Demultiplexed<PROPAGATE, RET> *output;
+                BasicDemultiplexed *output;
 
-                Embed(embed_type &&fn,
-                      Demultiplexed<PROPAGATE, RET> *output) noexcept
+                Embed(embed_type &&fn, BasicDemultiplexed *output) noexcept
                     : fn(fn),
                       output(output),
                       Work(flags::DONT_SCHEDULE) {}
                 Embed(const Embed &other) = delete;
-                friend class Demultiplexed<PROPAGATE, RET>;
+                friend class BasicDemultiplexed<INDEX, PROPAGATE, RET>;
 
               public:
                 inline void store(output_type v) { fn(v, *this); }
@@ -965,63 +3411,76 @@ namespace calcgraph {
                     return &output->lookup(key);
                 }
             };
-            auto ret = new Embed(std::move(fn), this);
+            auto ret = new (arena) Embed(std::move(fn), this);
             return Input<output_type>(*ret, ret);
         }
 
+        /**
+         * @brief Append the Work items connected to the unkeyed and every
+         * keyed output
+         */
+        inline void collect_dependents(std::vector<Work *> &out) const {
+            unkeyed.collect_dependents(out);
+            keyed.for_each(
+                [&out](const SingleList<PROPAGATE, value_type> &list) {
+                    list.collect_dependents(out);
+                });
+        }
+
       private:
-        std::unordered_map<key_type, SingleList<PROPAGATE, value_type>> keyed;
+        INDEX<key_type, SingleList<PROPAGATE, value_type>> keyed;
         SingleList<PROPAGATE, output_type> unkeyed;
 
         Connectable<value_type> &lookup(key_type key) {
-            auto found = keyed.emplace(std::piecewise_construct,
-                                       std::forward_as_tuple(key),
-                                       std::forward_as_tuple());
-            return found.first->second;
+            return keyed.emplace(key);
         }
     };
 
     /**
-     * @brief Statistics for a single evaluation of the calculation graph.
+     * @brief The default Demultiplexed output policy, which looks up keys in
+     * a FlatIndex
      */
-    struct Stats final {
-        /** @brief how many items were taken off the work queue */
-        uint16_t queued;
-        /** @brief how many Nodes were eval()'ed */
-        uint16_t worked;
-        /**
-         * @brief how many Nodes were added to this evaluation's heap
-         * multiple times (as they were dependent on more than one queued or
-         * dependent Node)
-         */
-        uint16_t duplicates;
+    template <template <typename> class PROPAGATE, typename RET>
+    using Demultiplexed = BasicDemultiplexed<FlatIndex, PROPAGATE, RET>;
+
+    /**
+     * @brief A Demultiplexed output policy with a different key index, e.g.
+     * DemultiplexedBy<DenseIndex>::type for small integral keys
+     */
+    template <template <typename, typename> class INDEX>
+    struct DemultiplexedBy final {
+        template <template <typename> class PROPAGATE, typename RET>
+        using type = BasicDemultiplexed<INDEX, PROPAGATE, RET>;
+    };
+
+    /**
+     * @brief The type-erased part of a Channel, so a Graph can keep a list of
+     * the Channels it drains
+     */
+    class ChannelBase {
+      public:
+        virtual ~ChannelBase() {}
+
+      protected:
+        ChannelBase() : next(nullptr) {}
+
         /**
-         * @brief how many dependencies were pushed back on to the Graph's
-         * work_queue to be evaluted next time
+         * @brief Store everything in the channel to its Input, and schedule
+         * the Input's Node
+         * @details Only called by one thread at a time.
          */
-        uint16_t pushed_graph;
+        virtual void drain(Graph &g) = 0;
+
         /**
-         * @brief how many dependencies were pushed onto this evaluation's
-         * work heap to be evaluated in topological order
+         * @brief Whether there's nothing waiting to be drained
          */
-        uint16_t pushed_heap;
+        virtual bool empty() const = 0;
 
-        operator std::string() const {
-            std::ostringstream out;
-            out << "queued: " << queued;
-            out << ", worked: " << worked;
-            out << ", duplicates: " << duplicates;
-            out << ", pushed_graph: " << pushed_graph;
-            out << ", pushed_heap: " << pushed_heap;
-            return out.str();
-        }
+      private:
+        ChannelBase *next;
+        friend class Graph;
     };
 
-    /**
-     * @brief A helper member to zero out a Stats object
-     */
-    static const struct Stats EmptyStats {};
-
     /**
      * @brief The calcuation-graph-wide state
      * @details This class is the only way to make calculation nodes in the
@@ -1030,7 +3489,10 @@ namespace calcgraph {
      */
     class Graph final {
       public:
-        Graph() : ids(1), tombstone(), work_queue(&tombstone) {}
+        Graph()
+            : ids(1), work_queue(&tombstone), tombstone(), reusable(*this),
+              budgets(), parked(0), wakeups(0), next_timer(NO_TIMER),
+              channels(nullptr) {}
 
         /**
          * @brief Run the graph evaluation to evalute all Work items on the
@@ -1041,7 +3503,25 @@ namespace calcgraph {
          *
          * @return true iff any Work items were eval'ed
          */
-        bool operator()(struct Stats * = nullptr);
+        bool operator()();
+
+        /**
+         * @brief As operator()(), but also records what happened in the given
+         * Stats object (if it's not null)
+         */
+        bool operator()(struct Stats *);
+
+        /**
+         * @brief As operator()(), but also records what happened (including
+         * histograms) in the given FullStats object (if it's not null)
+         */
+        bool operator()(struct FullStats *);
+
+        /**
+         * @brief As operator()(), so existing g(nullptr) calls aren't
+         * ambiguous between the Stats and FullStats overloads
+         */
+        inline bool operator()(std::nullptr_t) { return (*this)(); }
 
         /**
          * @brief Creates a builder object for Nodes
@@ -1049,6 +3529,113 @@ namespace calcgraph {
          */
         NodeBuilder<Always, SingleList> node();
 
+        /**
+         * @brief Start a transaction that appends values to many Inputs, and
+         * adds all the Nodes it schedules to the work_queue at once
+         * @details The Nodes are added when the Batch is committed or
+         * destroyed.
+         */
+        Batch batch();
+
+        /**
+         * @brief Reserve memory for Nodes built from now on, touching it from
+         * the calling thread
+         * @details See Arena::reserve; call this from the thread that will
+         * evaluate the Graph (after pinning it) so Nodes are allocated from
+         * memory local to that thread's NUMA node. start_evaluating does this.
+         *
+         * @param bytes Roughly how much memory the Graph's Nodes will need
+         */
+        inline void reserve(std::size_t bytes) { arena.reserve(bytes); }
+
+        /**
+         * @brief Create a Channel that passes values from another Graph (or
+         * any other single thread) to the given Input of a Node on this Graph
+         * @details Connect the Channel to one Node on the other Graph (or
+         * store to it from one thread). Values stored to the Channel are
+         * buffered in a lock-free single-producer single-consumer queue, and
+         * only passed to the Input (which schedules its Node) when this Graph
+         * is next evaluated, so the producing thread never touches this
+         * Graph's work_queue. The Channel is owned by this Graph, so this
+         * Graph must outlive anything that stores to it.
+         *
+         * @tparam N The capacity of the queue, which must be a power of two;
+         * values stored when it's full are dropped (see Channel::try_store)
+         */
+        template <typename VAL, std::size_t N = 1024>
+        Channel<VAL, N> &channel(Input<VAL> to);
+
+        /**
+         * @brief Evaluate the work_queue, and then recalculate every stale
+         * Lazy Node in Work::id order until there's nothing left to do
+         * @details Recalculating a Lazy Node passes its result on to its
+         * dependents, which are then evaluated (so downstream Lazy Nodes are
+         * marked stale and recalculated in turn). Any thread can call this,
+         * but if another thread's evaluating the Graph at the same time it
+         * may not see all of the last round of invalidations.
+         */
+        void pull();
+
+        /**
+         * @brief Add a Work item to the work_queue at (or shortly after) the
+         * given time
+         * @details Timers are checked at the start of each evaluation, so
+         * need something (like evaluate_repeatedly, or evaluate_or_park,
+         * which won't park past the next timer) to be evaluating the Graph.
+         * Thread-safe.
+         */
+        void schedule_at(Work &w, std::chrono::steady_clock::time_point when);
+
+        /**
+         * @brief Limit how long each evaluation spends on a priority lane
+         * @details The lane's clock starts when an evaluation pops its first
+         * Work from that lane, so time spent on higher-priority lanes isn't
+         * charged to it. Once the lane has been running for longer than the
+         * budget, any Work left in it is put back on the work_queue for the
+         * next evaluation (and counted in Stats::deferred) rather than
+         * evaluated, so a busy low-priority lane can't hold up the next
+         * evaluation's high-priority Work. Each evaluation always evaluates
+         * at least one Work from each lane, so even a lane with a tiny budget
+         * makes progress. A zero budget (the default) is
+         * unlimited. Only operator() (and so evaluate_repeatedly and
+         * evaluate_or_park) honour budgets, not evaluate_in_parallel.
+         */
+        void budget(Priority lane, std::chrono::nanoseconds limit);
+
+        /**
+         * @brief Renumber the Nodes reachable from the given roots in
+         * topological order
+         * @details Follows each Node's connections to the dependents it
+         * schedules (so not a Weak Node's, which is how cycles are broken), and
+         * hands the reached Nodes fresh ids (higher than any id handed out
+         * so far) in a topological order of those connections (breaking ties
+         * by the old ids), so after a Graph's been built up dynamically (e.g.
+         * with Node::embed) each change is evaluated in a single pass rather
+         * than spilling over into the next evaluation wherever a dependency
+         * was built after its dependent. As the reached Nodes are moved after
+         * every Node that wasn't reached, the roots should include the
+         * Graph's sources; anything upstream of the roots that isn't reached
+         * still comes first, but ids aren't dense afterwards. Connections made
+         * by embedded functions can't be seen. Ids are written non-atomically,
+         * so this mustn't be called concurrently with evaluation of the Graph
+         * or any Input::append to its Nodes.
+         *
+         * @returns false, leaving all the ids unchanged, if the connections
+         * have a cycle (so there's no topological order) or there aren't
+         * enough ids left to hand out
+         */
+        bool compact(const std::vector<Work *> &roots);
+
+#ifdef CALCGRAPH_METRICS
+        /**
+         * @brief Get a snapshot of the metrics of every Node created by this
+         * Graph that's still alive
+         * @details Thread-safe, and doesn't block evaluation (although the
+         * metrics of a Node being evaluated may be mid-update).
+         */
+        std::vector<NodeMetrics> metrics();
+#endif
+
         ~Graph() {
             auto head =
                 work_queue.exchange(&tombstone, std::memory_order_acq_rel);
@@ -1058,6 +3645,20 @@ namespace calcgraph {
                 intrusive_ptr_release(w);
                 w = next;
             }
+
+            ChannelBase *c = channels.load(std::memory_order_acquire);
+            while (c) {
+                ChannelBase *next = c->next;
+                delete c;
+                c = next;
+            }
+
+            for (Work *lazy : stale) {
+                intrusive_ptr_release(lazy);
+            }
+            for (auto &timer : timers) {
+                intrusive_ptr_release(timer.second);
+            }
         }
 
       private:
@@ -1085,14 +3686,203 @@ namespace calcgraph {
          */
         Tombstone tombstone;
 
+        /**
+         * @brief Where NodeBuilder allocates Nodes from
+         */
+        Arena arena;
+
+        /**
+         * @brief What this Graph's Nodes' inputs retire replaced values to,
+         * pinned for each evaluation and collected at the end of it
+         */
+        Epoch epoch;
+
+        /**
+         * @brief The evaluation state (and so heap storage) reused by
+         * operator()
+         * @details Guarded by the evaluating flag; if another thread is
+         * already evaluating this Graph then operator() falls back to a
+         * temporary WorkState.
+         */
+        WorkState reusable;
+        std::atomic_flag evaluating = ATOMIC_FLAG_INIT;
+
+        /**
+         * @brief Each lane's time budget in nanoseconds, or zero if unlimited
+         */
+        std::atomic<int64_t> budgets[PRIORITIES];
+
+        /**
+         * @brief The implementation of operator(), templated on a stats
+         * policy (see the .cpp file) so the bookkeeping the caller didn't ask
+         * for compiles away
+         */
+        template <typename STATS>
+        bool run(STATS stats);
+
+        /**
+         * @brief Evaluate everything reachable from the given work_queue head
+         * using the given (empty) WorkState
+         */
+        template <typename STATS>
+        void evaluate(Work *head, WorkState &work, STATS &stats);
+
+        /**
+         * @brief How many threads are (or are about to be) blocked in park()
+         * waiting for work
+         */
+        std::atomic<uint32_t> parked;
+
+        /**
+         * @brief Incremented by unpark() to wake parked threads
+         * @details Used as a futex word on Linux.
+         */
+        std::atomic<uint32_t> wakeups;
+
+        /**
+         * @brief Block the calling thread until something is added to an empty
+         * work_queue, or until the timeout expires
+         */
+        void park(std::chrono::milliseconds timeout);
+
+        /**
+         * @brief Wake up any threads blocked in park()
+         * @details Called by Work::schedule only when it adds a Work item to an
+         * empty work_queue, and only makes a system call if a thread is
+         * parked.
+         */
+        inline void wake() {
+            if (parked.load(std::memory_order_seq_cst))
+                unpark();
+        }
+        void unpark();
+
+        /**
+         * @brief Claim a Work item and add it to the front of a private
+         * chain, as in Batch
+         * @details Does nothing if the Work's already on a work_queue or
+         * chain. The chain's tail points at the tombstone until it's spliced.
+         */
+        void chain(Work &w, Work *&first, Work *&tail);
+
+        /**
+         * @brief Add a chain built by chain() to the work_queue with a single
+         * compare-and-swap
+         */
+        void splice(Work *first, Work *tail);
+
+        /**
+         * @brief Lazy Nodes that have been marked stale since pull() last
+         * recalculated them, each with a reference held
+         * @details Guarded by the stale_lock spinlock.
+         */
+        std::vector<Work *> stale;
+        std::atomic_flag stale_lock = ATOMIC_FLAG_INIT;
+
+        /**
+         * @brief Work items to schedule at a given time, as a heap with the
+         * earliest first, each with a reference held
+         * @details Guarded by the timer_lock spinlock.
+         */
+        std::vector<std::pair<std::chrono::steady_clock::time_point, Work *>>
+            timers;
+        std::atomic_flag timer_lock = ATOMIC_FLAG_INIT;
+        struct TimerCmp final {
+            inline bool operator()(
+                const std::pair<std::chrono::steady_clock::time_point, Work *>
+                    &a,
+                const std::pair<std::chrono::steady_clock::time_point, Work *>
+                    &b) const {
+                return a.first > b.first;
+            }
+        };
+
+        /**
+         * @brief The time (as a steady_clock tick count) of the earliest
+         * timer, so evaluations can check it without taking the lock
+         */
+        std::atomic<int64_t> next_timer;
+        static const int64_t NO_TIMER = std::numeric_limits<int64_t>::max();
+
+        /**
+         * @brief Schedule any Work whose timers are due
+         */
+        void fire_timers();
+
+        /**
+         * @brief The Channels created by channel(), as an intrusive
+         * singly-linked list that's only ever added to
+         */
+        std::atomic<ChannelBase *> channels;
+        std::atomic_flag draining = ATOMIC_FLAG_INIT;
+
+        /**
+         * @brief Pass everything waiting in this Graph's Channels on to their
+         * Inputs
+         * @details Called at the start of each evaluation. Channels only have
+         * a single consumer, so if another thread's already draining them
+         * this does nothing.
+         */
+        inline void drain_channels() {
+            ChannelBase *c = channels.load(std::memory_order_acquire);
+            if (!c || draining.test_and_set(std::memory_order_acquire))
+                return;
+            for (; c; c = c->next) {
+                c->drain(*this);
+            }
+            draining.clear(std::memory_order_release);
+        }
+
+        /**
+         * @brief Whether any of this Graph's Channels have values waiting
+         */
+        bool channels_pending() const;
+
+#ifdef CALCGRAPH_METRICS
+        /**
+         * @brief The metrics of the Nodes this Graph has created, guarded by
+         * the tracking spinlock
+         */
+        std::vector<std::weak_ptr<Work::Counters>> tracked;
+        std::atomic_flag tracking = ATOMIC_FLAG_INIT;
+#endif
+
+        /**
+         * @brief Register a newly-created Node so its metrics are included in
+         * metrics()
+         */
+#ifdef CALCGRAPH_METRICS
+        inline void track(Work &w) {
+            while (tracking.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            tracked.push_back(w.counters);
+            tracking.clear(std::memory_order_release);
+        }
+#else
+        inline void track(Work & /*w*/) {}
+#endif
+
+        friend void evaluate_or_park(Graph &, std::atomic<bool> &, uint32_t,
+                                     std::chrono::milliseconds);
+
         friend class WorkState;
+        friend class Batch;
+        template <typename, std::size_t>
+        friend class Channel;
         template <typename>
         friend class Input;
         template <template <typename> class,
                   template <template <typename> class, typename> class,
                   class...>
         friend class NodeBuilder;
+        template <template <typename> class,
+                  template <template <typename> class, typename> class,
+                  typename, typename...>
+        friend class Node;
         friend class Work;
+        friend void evaluate_in_parallel(Graph &, std::atomic<bool> &,
+                                         unsigned);
 
         template <typename... INPUTS, std::size_t... I>
         void connectall(std::index_sequence<I...>,
@@ -1129,6 +3919,42 @@ namespace calcgraph {
             }
         }
 
+        /**
+         * @brief Sets the input to each of the values in the range in turn, but
+         * only schedules the Node once
+         * @details Useful with accumulating input policies (e.g. Batched or
+         * Ring) to pass on many values, such as a batch of datagrams, without
+         * contending on the Graph's work_queue for each one.
+         */
+        template <typename ITER>
+        void append_many(Graph &graph, ITER first, ITER last) {
+            if (first == last)
+                return;
+            for (; first != last; ++first) {
+                in->store(*first);
+            }
+            if (ref) {
+                ref->schedule(graph);
+            }
+        }
+
+        /**
+         * @brief Like append, but lets bounded Input policies (e.g. a Ring
+         * with Overflow::REJECT) refuse the value when they're full
+         * @details The Node is only scheduled if the value was accepted.
+         *
+         * @returns false if the value was discarded, so the caller can apply
+         * backpressure to its producer
+         */
+        bool try_append(Graph &graph, INPUT v) {
+            if (!in->try_store(std::move(v)))
+                return false;
+            if (ref) {
+                ref->schedule(graph);
+            }
+            return true;
+        }
+
         Input(std::shared_ptr<Storeable<INPUT>> in) noexcept : in(in.get()),
                                                                ref() {}
         Input(Storeable<INPUT> *in) noexcept : in(in), ref() {}
@@ -1178,10 +4004,167 @@ namespace calcgraph {
         friend class Accumulator;
         template <template <typename> class, typename>
         friend class SingleList;
-        template <template <typename> class, typename>
-        friend class Demultiplexed;
+        template <template <typename, typename> class,
+                  template <typename> class, typename>
+        friend class BasicDemultiplexed;
+        friend class Batch;
+        template <typename, std::size_t>
+        friend class Channel;
+        friend class Recorder;
+    };
+
+    /**
+     * @brief A transaction that stores values to many Inputs, and then adds
+     * all the Nodes that need re-evaluating to the Graph's work_queue with a
+     * single compare-and-swap
+     * @details Obtained from Graph::batch(). Nodes aren't added to the
+     * work_queue (so won't be evaluated) until commit() is called or the Batch
+     * is destroyed, but will be evaluated with the values stored by the
+     * Batch's append calls even if another thread schedules them in the
+     * meantime. Not thread-safe; use one Batch per thread.
+     */
+    class Batch final {
+      public:
+        /**
+         * @brief Store a value to an Input, and add its Node to this Batch
+         */
+        template <typename INPUT>
+        void append(const Input<INPUT> &input,
+                    typename std::common_type<INPUT>::type v) {
+            input.in->store(std::move(v));
+            if (input.ref)
+                add(*input.ref);
+        }
+
+        /**
+         * @brief Store many values to an Input, and add its Node to this Batch
+         */
+        template <typename INPUT, typename ITER>
+        void append_many(const Input<INPUT> &input, ITER first, ITER last) {
+            if (first == last)
+                return;
+            for (; first != last; ++first) {
+                input.in->store(*first);
+            }
+            if (input.ref)
+                add(*input.ref);
+        }
+
+        /**
+         * @brief Add the Nodes of all the Inputs appended to so far to the
+         * Graph's work_queue
+         * @details The Batch can be reused afterwards.
+         */
+        void commit();
+
+        Batch(Batch &&other) noexcept : g(other.g),
+                                        first(other.first),
+                                        tail(other.tail) {
+            other.first = other.tail = nullptr;
+        }
+        Batch(const Batch &other) = delete;
+        ~Batch() { commit(); }
+
+      private:
+        Batch(Graph &g) noexcept : g(g), first(nullptr), tail(nullptr) {}
+        friend class Graph;
+
+        Graph &g;
+
+        /**
+         * @brief The chain of claimed Work items, linked through their next
+         * pointers from first to tail
+         * @details tail points to the Graph's tombstone until commit() points
+         * it at the head of the work_queue.
+         */
+        Work *first;
+        Work *tail;
+
+        void add(Work &w);
+    };
+
+    /**
+     * @brief A connection from another Graph to an Input of a Node on the
+     * Graph that created it
+     * @details Obtained from Graph::channel(). Implements Storeable, so
+     * connecting a Node on another Graph to the Channel passes the Node's
+     * results to the Channel's Input without the other Graph's evaluation
+     * thread scheduling anything on this one. Only one thread at a time may
+     * store to a Channel (for example, by connecting a single Node to it).
+     */
+    template <typename VAL, std::size_t N>
+    class Channel final : public Storeable<VAL>, public ChannelBase {
+      public:
+        /**
+         * @brief Queue a value for the Input, dropping it if the Channel's
+         * full
+         */
+        void store(VAL v) override { try_store(std::move(v)); }
+
+        /**
+         * @returns false if the Channel was full, so the value was dropped
+         */
+        bool try_store(VAL v) override {
+            if (!queue.push(v)) {
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // the Graph might be parked in evaluate_or_park; the fence orders
+            // the push before reading Graph::parked, pairing with park()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            g.wake();
+            return true;
+        }
+
+        /**
+         * @brief How many values have been dropped because the Channel was
+         * full
+         */
+        uint64_t dropped() const {
+            return dropped_count.load(std::memory_order_relaxed);
+        }
+
+        Channel(const Channel &) = delete;
+
+      protected:
+        void drain(Graph &graph) override {
+            VAL v;
+            bool any = false;
+            while (queue.pop(v)) {
+                to.in->store(std::move(v));
+                any = true;
+            }
+            if (any && to.ref) {
+                to.ref->schedule(graph);
+            }
+        }
+
+        bool empty() const override { return queue.empty(); }
+
+      private:
+        Channel(Graph &g, Input<VAL> to)
+            : g(g), to(std::move(to)), dropped_count(0) {}
+
+        Graph &g;
+        Input<VAL> to;
+        SpscQueue<VAL, N> queue;
+        std::atomic<uint64_t> dropped_count;
+
+        friend class Graph;
     };
 
+    template <typename VAL, std::size_t N>
+    Channel<VAL, N> &Graph::channel(Input<VAL> to) {
+        auto c = new Channel<VAL, N>(*this, std::move(to));
+        ChannelBase *head = channels.load(std::memory_order_relaxed);
+        do {
+            c->next = head;
+        } while (!channels.compare_exchange_weak(head, c,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+        return *c;
+    }
+
     /**
      * @brief A Work item that evaluates a function, and propages the
      *results to any connected Inputs.
@@ -1257,7 +4240,7 @@ namespace calcgraph {
          *you should schedule the Node directly.
          *
          * @tparam N which function argument to get; it must have a Variadic
-         * input policy
+         * (or Incremental) input policy
          */
         template <std::size_t N>
         Input<typename std::tuple_element<
@@ -1286,7 +4269,7 @@ namespace calcgraph {
          *after passed to this method.
          *
          * @tparam N which function argument to get; it must have a Variadic
-         * input policy
+         * (or Incremental) input policy
          */
         template <std::size_t N>
         void variadic_remove(Input<typename std::tuple_element<
@@ -1350,10 +4333,19 @@ namespace calcgraph {
          * WorkState Graph's work_queue.
          */
         void eval(WorkState &ws) override {
+            if (is_lazy<PROPAGATE<RET>>::value) {
+                // just remember we need recalculating when someone asks
+                cache.stale.store(true, std::memory_order_release);
+                if (!cache.listed.exchange(true, std::memory_order_acq_rel))
+                    ws.invalidated(*this);
+                return;
+            }
+
             if (!this->trylock()) {
                 // another calculation in progress, so put us on the work
                 // queue (which will change the next pointer to the next node in
                 // the work queue, not this)
+                this->metrics_contended();
                 ws.add_to_queue(*this);
                 return;
             }
@@ -1366,7 +4358,9 @@ namespace calcgraph {
             // be unnecessary. See the OnChange propagation policy to
             // mitagate this (your function should be idempotent!).
 
+            uint64_t started = this->metrics_started();
             RET val = call_fn(std::index_sequence_for<INPUTS...>{});
+            this->metrics_finished(started);
             output.propagate(std::move(val), ws);
 
             this->release();
@@ -1380,17 +4374,95 @@ namespace calcgraph {
          *attached to an Input and connected to this Node using connect, so is
          *executed after the Node's main function is executed (i.e. when the
          *results of the Node's function are passed to the output policy).
+         *The function's allocated from the Graph's Arena (next to the Nodes
+         *built around the same time), so the Graph must still exist.
          *
          * @return An Input that can be used to remove this function from the
          *Node - pass it as the argument to disconnect.
          */
         Input<output_type>
         embed(std::function<void(output_type, interface_type &)> fn) {
-            Input<output_type> ret = output.embed(std::move(fn));
+            Input<output_type> ret = output.embed(arena, std::move(fn));
             connect(ret);
             return ret;
         }
 
+        /**
+         * @brief Get the result of a Lazy Node's function, calling it on the
+         * current INPUTS values first if they've changed since it was last
+         * called
+         * @details A recalculated result is passed on to any connected
+         * Inputs, scheduling their Nodes on the given Graph's work_queue. Only
+         * this Node is recalculated; if its inputs come from other stale Lazy
+         * Nodes, use Graph::pull to bring them all up to date first.
+         */
+        template <template <typename> class P = PROPAGATE>
+        std::enable_if_t<is_lazy<P<RET>>::value, RET> get(Graph &g) {
+            this->spinlock();
+            refresh_locked(g);
+            RET ret = cache.value;
+            this->release();
+            return ret;
+        }
+
+        /**
+         * @brief Append the Work items of the connected Inputs
+         * @details Takes the Node's lock, so Inputs can be connected at the
+         * same time.
+         */
+        void collect_dependents(std::vector<Work *> &out) override {
+            spinlock();
+            output.collect_dependents(out);
+            release();
+        }
+
+        /**
+         * @brief Append the state of this Node's input policies and output
+         * policy (see save_part) to out
+         * @details Used by Checkpoint. Takes the Node's lock.
+         */
+        void save_state(std::string &out) {
+            this->spinlock();
+            save_inputs(std::index_sequence_for<INPUTS...>{}, out);
+            save_part(output, out);
+            this->release();
+        }
+
+        /**
+         * @brief Restore the state saved by save_state
+         * @details Takes the Node's lock, so its Inputs can be connected
+         * (but shouldn't be appended to) at the same time. Every part is
+         * checked before any is stored, so a Node whose state can't be
+         * restored is left as it was.
+         * @returns false if any part of the state couldn't be restored, e.g.
+         * because the Node's inputs have changed type since it was saved
+         */
+        bool restore_state(const char *first, const char *last) {
+            this->spinlock();
+            const char *check = first;
+            bool ok = restore_inputs(std::index_sequence_for<INPUTS...>{},
+                                     check, last, false) &&
+                      restore_part(output, check, last, false) &&
+                      check == last;
+            if (ok) {
+                restore_inputs(std::index_sequence_for<INPUTS...>{}, first,
+                               last, true);
+                restore_part(output, first, last, true);
+            }
+            this->release();
+            return ok;
+        }
+
+        void refresh(Graph &g) override {
+            if (!is_lazy<PROPAGATE<RET>>::value)
+                return;
+            cache.listed.store(false, std::memory_order_release);
+            this->spinlock();
+            refresh_locked(g);
+            this->release();
+        }
+
+
       private:
         /**
          * The policy on what connected values to pass FN outputs to
@@ -1400,14 +4472,89 @@ namespace calcgraph {
         const FN fn;
         std::tuple<INPUTS...> inputs;
 
-        Node(uint32_t id, const FN fn,
+        /**
+         * @brief The Graph's Arena this Node was allocated from, which embed
+         * allocates from too
+         */
+        Arena &arena;
+
+        /**
+         * @brief The cached result of a Lazy Node
+         */
+        struct LazyCache {
+            std::atomic<bool> stale{true};
+            /** @brief Whether this Node's in the Graph's stale list */
+            std::atomic<bool> listed{false};
+            RET value{};
+        };
+        struct NoCache {
+            std::atomic<bool> stale{false};
+            std::atomic<bool> listed{false};
+            struct {
+            } value;
+        };
+        typename std::conditional<is_lazy<PROPAGATE<RET>>::value, LazyCache,
+                                  NoCache>::type cache;
+
+        /**
+         * @brief Recalculate a stale Lazy Node; must hold the Node's lock
+         */
+        inline void refresh_locked(Graph &g) {
+            refresh_locked(g, is_lazy<PROPAGATE<RET>>());
+        }
+        void refresh_locked(Graph &, std::false_type) {}
+        void refresh_locked(Graph &g, std::true_type) {
+            if (!cache.stale.exchange(false, std::memory_order_acq_rel))
+                return;
+
+            Epoch::Guard pinned(g.epoch); // for Borrowed inputs
+            uint64_t started = this->metrics_started();
+            RET val = call_fn(std::index_sequence_for<INPUTS...>{});
+            this->metrics_finished(started);
+            cache.value = val;
+
+            // we're not part of an evaluation, so anything this schedules
+            // goes on the work_queue for the next one
+            WorkState ws(g);
+            ws.current_rank = std::numeric_limits<uint64_t>::max();
+            output.propagate(std::move(val), ws);
+        }
+
+        Node(uint32_t id, Arena &arena, Epoch &epoch, const FN fn,
              std::tuple<typename INPUTS::input_type...> initials)
-            : Work(id), fn(fn), inputs(initials) {}
+            : Work(id), fn(fn), inputs(initials), arena(arena) {
+            bind_inputs(std::index_sequence_for<INPUTS...>{}, epoch);
+        }
         friend class Graph;
 
+        template <std::size_t... I>
+        inline void bind_inputs(std::index_sequence<I...>, Epoch &epoch) {
+            int forceexpansion[] = {
+                0, (bind_epoch(std::get<I>(inputs), epoch, 0), 0)...};
+            (void)forceexpansion;
+        }
+        template <std::size_t... I>
+        inline void save_inputs(std::index_sequence<I...>, std::string &out) {
+            int forceexpansion[] = {
+                0, (save_part(std::get<I>(inputs), out), 0)...};
+            (void)forceexpansion;
+        }
+        template <std::size_t... I>
+        inline bool restore_inputs(std::index_sequence<I...>,
+                                   const char *&first, const char *last,
+                                   bool apply) {
+            bool ok = true;
+            int forceexpansion[] = {
+                0, (ok = restore_part(std::get<I>(inputs), first, last,
+                                      apply) && ok,
+                    0)...};
+            (void)forceexpansion;
+            return ok;
+        }
+
         template <std::size_t... I>
         inline RET call_fn(std::index_sequence<I...>) {
-            return fn(std::get<I>(inputs).read()...);
+            return fn(read_input(std::get<I>(inputs), 0)...);
         }
         template <std::size_t... I>
         inline auto inputtuple_fn(std::index_sequence<I...>) {
@@ -1421,6 +4568,133 @@ namespace calcgraph {
         friend class NodeBuilder;
     };
 
+    /**
+     * @brief A chain of functions called one after the other as a single
+     * Node's function, built by NodeBuilder::pipe
+     * @details Each intermediate value is passed straight to the next
+     * function. Like the OnChange propagation policy, if a function returns
+     * a value equal to the one it returned last time (comparing what
+     * std::shared_ptrs point to) the rest of the chain isn't called and the
+     * previous result is returned instead. So intermediate values must be
+     * equality-comparable and copyable, and the chain's result
+     * default-constructible. The memoized values aren't synchronized, which
+     * is fine as a Node's function is only called with the Node locked.
+     *
+     * @tparam ARGS A std::tuple of the types the first function's called with
+     * @tparam FNS The functions, in the order they're called
+     */
+    template <typename ARGS, typename... FNS>
+    class Fused;
+
+    template <typename... ARGS, typename FN>
+    class Fused<std::tuple<ARGS...>, FN> final {
+      public:
+        using result_type = std::decay_t<std::result_of_t<const FN &(ARGS...)>>;
+
+        explicit Fused(FN fn) : fn(fn) {}
+
+        inline result_type operator()(ARGS... args) const {
+            return fn(std::move(args)...);
+        }
+
+      private:
+        FN fn;
+    };
+
+    template <typename... ARGS, typename FN, typename NEXT, typename... REST>
+    class Fused<std::tuple<ARGS...>, FN, NEXT, REST...> final {
+        using mid_type = std::decay_t<std::result_of_t<const FN &(ARGS...)>>;
+        using tail_type = Fused<std::tuple<mid_type>, NEXT, REST...>;
+
+      public:
+        using result_type = typename tail_type::result_type;
+
+        Fused(FN fn, NEXT next, REST... rest)
+            : fn(fn), tail(next, rest...), seen(false), last(), result() {}
+
+        inline result_type operator()(ARGS... args) const {
+            mid_type mid = fn(std::move(args)...);
+            if (!seen || changed(last, mid)) {
+                seen = true;
+                result = tail(mid);
+                last = std::move(mid);
+            }
+            return result;
+        }
+
+      private:
+        FN fn;
+        tail_type tail;
+        mutable bool seen;
+        mutable mid_type last;
+        mutable result_type result;
+
+        template <typename VAL>
+        static inline bool changed(const VAL &a, const VAL &b) {
+            return differs(a, b);
+        }
+        template <typename VAL>
+        static inline bool changed(const std::shared_ptr<VAL> &a,
+                                   const std::shared_ptr<VAL> &b) {
+            if (a && b)
+                return differs(*a, *b);
+            else
+                return a != b;
+        }
+    };
+
+    /**
+     * @brief The builder returned by NodeBuilder::pipe, which collects the
+     * functions to fuse into a single Node
+     * @tparam BUILDER The NodeBuilder it's extending
+     * @tparam FNS The functions added so far
+     */
+    template <typename BUILDER, typename... FNS>
+    class Pipeline final {
+      public:
+        /**
+         * @brief Call the given function on the result of the functions
+         * added so far
+         */
+        template <typename NEXT>
+        auto pipe(const NEXT next) const {
+            return Pipeline<BUILDER, FNS..., NEXT>(
+                builder, std::tuple_cat(fns, std::make_tuple(next)));
+        }
+
+        /**
+         * @brief Build a Node whose function is the chain of functions
+         * @see NodeBuilder::connect
+         */
+        template <typename... VALS>
+        auto connect(Connectable<VALS> *... args) {
+            using fused_type =
+                Fused<typename BUILDER::template args_type<VALS...>, FNS...>;
+            return builder.connect(
+                make_fused<fused_type>(std::index_sequence_for<FNS...>{}),
+                args...);
+        }
+
+      private:
+        BUILDER builder;
+        std::tuple<FNS...> fns;
+
+        Pipeline(BUILDER builder, std::tuple<FNS...> fns)
+            : builder(builder), fns(fns) {}
+
+        template <typename FUSED, std::size_t... I>
+        inline FUSED make_fused(std::index_sequence<I...>) const {
+            return FUSED(std::get<I>(fns)...);
+        }
+
+        template <template <typename> class,
+                  template <template <typename> class, typename> class,
+                  class...>
+        friend class NodeBuilder;
+        template <typename, typename...>
+        friend class Pipeline;
+    };
+
     /**
      * @brief A builder-pattern object for constructing Nodes
      * @details Can be reused to create multiple Nodes. Arguments can be
@@ -1448,15 +4722,44 @@ namespace calcgraph {
          */
         template <template <typename> class NEWPROPAGATE>
         auto propagate() {
-            return NodeBuilder<NEWPROPAGATE, OUTPUT, INPUTS...>(g, connected,
-                                                                initials);
+            return NodeBuilder<NEWPROPAGATE, OUTPUT, INPUTS...>(
+                g, connected, initials, lane);
         }
 
         template <template <template <typename> class, typename>
                   class NEWOUTPUT>
         auto output() {
-            return NodeBuilder<PROPAGATE, NEWOUTPUT, INPUTS...>(g, connected,
-                                                                initials);
+            return NodeBuilder<PROPAGATE, NEWOUTPUT, INPUTS...>(
+                g, connected, initials, lane);
+        }
+
+        /**
+         * @brief Change the priority lane the Nodes the builder constructs
+         * are evaluated in
+         * @details Work in a higher lane is evaluated before Work in a lower
+         * lane, so a Node should be in the same or a lower lane than the Nodes
+         * it depends on; a Node in a higher lane than a dependency is only
+         * evaluated in the Graph evaluation after the dependency's (just like
+         * a Node with a lower id than its dependency).
+         */
+        auto priority(Priority p) const {
+            return NodeBuilder(g, connected, initials, p);
+        }
+
+        /**
+         * @brief Start building a Node whose function is a chain of functions,
+         * fused at compile time
+         * @details Add more functions to the chain with Pipeline::pipe, and
+         * build the Node with Pipeline::connect. Unlike a chain of Nodes,
+         * there's no Input, work queue or heap between the functions; see
+         * Fused for how intermediate values are passed on.
+         *
+         * @param fn The first function, which is called with the Node's
+         * inputs
+         */
+        template <typename FN>
+        auto pipe(const FN fn) const {
+            return Pipeline<NodeBuilder, FN>(*this, std::make_tuple(fn));
         }
 
         /**
@@ -1467,6 +4770,24 @@ namespace calcgraph {
             return doconnect<Accumulate, VAL>(arg);
         }
 
+        /**
+         * @brief Add an argument with a Batched input policy
+         */
+        template <typename VAL>
+        auto batched(Connectable<VAL> *arg = nullptr) {
+            return doconnect<Batched, VAL>(arg);
+        }
+
+        /**
+         * @brief Add an argument with a Ring input policy, which buffers up to
+         * N values and passes them to the function as a View
+         */
+        template <typename VAL, std::size_t N,
+                  Overflow O = Overflow::DROP_OLDEST>
+        auto ring(Connectable<VAL> *arg = nullptr) {
+            return doconnect<Ring<N, O>::template type, VAL>(arg);
+        }
+
         /**
          * @brief Add an argument with a Latest input policy
          *
@@ -1504,6 +4825,24 @@ namespace calcgraph {
                 static_cast<Connectable<VAL> *>(nullptr));
         }
 
+        /**
+         * @brief Add an argument with an Incremental input policy
+         */
+        template <typename VAL>
+        auto incremental() {
+            return doconnect<Incremental, VAL>(
+                static_cast<Connectable<std::nullptr_t> *>(nullptr));
+        }
+
+        /**
+         * @brief Add an argument with a Borrowed input policy, so the
+         * function's given a raw pointer to the latest value
+         */
+        template <typename VAL>
+        auto borrowed(Connectable<std::shared_ptr<VAL>> *arg = nullptr) {
+            return doconnect<Borrowed, std::shared_ptr<VAL>>(arg);
+        }
+
         /**
          * @brief Add an argument with a Variadic input policy
          */
@@ -1543,8 +4882,10 @@ namespace calcgraph {
                 std::tuple_cat(initials, std::move(newinitials));
             auto node = boost::intrusive_ptr<
                 Node<PROPAGATE, OUTPUT, FN, INPUTS..., Latest<VALS>...>>(
-                new Node<PROPAGATE, OUTPUT, FN, INPUTS..., Latest<VALS>...>(
-                    g.ids++, fn, finalinitials));
+                new (g.arena)
+                    Node<PROPAGATE, OUTPUT, FN, INPUTS..., Latest<VALS>...>(
+                        g.ids++, g.arena, g.epoch, fn, finalinitials));
+            node->lane = lane;
 
             // next, connect any given inputs
             auto newargs =
@@ -1552,6 +4893,7 @@ namespace calcgraph {
             auto finalargs = std::tuple_cat(connected, std::move(newargs));
             g.connectall(std::index_sequence_for<INPUTS..., VALS...>{},
                          finalargs, node->inputtuple());
+            g.track(*node);
 
             // finally schedule it for evaluation
             node->schedule(g);
@@ -1566,9 +4908,21 @@ namespace calcgraph {
         Graph &g;
         STORED connected;
         INITIALS initials;
+        Priority lane;
 
-        NodeBuilder(Graph &g, STORED connected = {}, INITIALS initials = {})
-            : g(g), connected(connected), initials(initials) {}
+        /**
+         * @brief The types the function of a Node built by connect with
+         * arguments of type VALS is called with
+         */
+        template <typename... VALS>
+        using args_type = std::tuple<typename INPUTS::output_type...,
+                                     typename Latest<VALS>::output_type...>;
+        template <typename, typename...>
+        friend class Pipeline;
+
+        NodeBuilder(Graph &g, STORED connected = {}, INITIALS initials = {},
+                    Priority lane = Priority::NORMAL)
+            : g(g), connected(connected), initials(initials), lane(lane) {}
 
         friend class Graph;
         template <template <typename> class,
@@ -1590,7 +4944,7 @@ namespace calcgraph {
                 std::tuple_cat(initials, std::move(new_initial));
 
             return NodeBuilder<PROPAGATE, OUTPUT, INPUTS..., POLICY<VAL>>(
-                g, new_connected, new_initials);
+                g, new_connected, new_initials, lane);
         }
     };
 
@@ -1606,6 +4960,350 @@ namespace calcgraph {
      * time it sees the work_queue empty
      */
     void evaluate_repeatedly(Graph &g, std::atomic<bool> &stop);
+
+    /**
+     * @brief Repeatedly evaluate the Graph's work queue, blocking when it's
+     * been idle for a while
+     * @details Like evaluate_repeatedly, this evaluates in a busy-loop and
+     * yields when there's no work to do. However, after the given number of
+     * consecutive idle iterations the thread blocks (on a futex, on Linux)
+     * until an Input adds work to the Graph's empty work_queue. The
+     * appending thread only makes a system call to wake the evaluation thread
+     * when it's the one that adds to an empty work_queue and this thread is
+     * actually asleep, so the busy hot path is unchanged but idle graphs don't
+     * use up a whole core.
+     *
+     * @param g The graph containing the work_queue to evaluate
+     * @param stop When set, the thread will exit its loop the next time it
+     * sees the work_queue empty
+     * @param spins How many consecutive iterations to find the work_queue empty
+     * before blocking
+     * @param timeout The maximum time to block for before checking the stop
+     * flag again
+     */
+    void evaluate_or_park(Graph &g, std::atomic<bool> &stop,
+                          uint32_t spins = 1000,
+                          std::chrono::milliseconds timeout =
+                              std::chrono::milliseconds(100));
+
+    /**
+     * @brief Repeatedly evaluate the Graph's work queue using a pool of
+     * threads
+     * @details Each evaluation takes the whole of the Graph's work_queue and
+     * splits it into independent subgraphs: Work items whose dependents
+     * (followed transitively through Node connections) overlap end up in the
+     * same subgraph. Idle threads take whole subgraphs, and each thread
+     * evaluates a subgraph on its own heap in increasing Work::id order, just
+     * as operator() would. As no dependency crosses between threads, a Node
+     * never sees a mix of updated and stale upstream values, and a graph made
+     * up of many independent pipelines scales with the number of threads
+     * (although pipelines that all feed one Node form a single subgraph).
+     * Each evaluation finishes before the next one starts, and like
+     * evaluate_repeatedly idle threads yield rather than block.
+     *
+     * @param g The graph containing the work_queue to evaluate
+     * @param stop When set, all the threads exit their busy-loops once the
+     * current evaluation's finished, and this function returns once they
+     * have all finished
+     * @param threads How many threads to evaluate the Graph with, including
+     * the calling thread
+     */
+    void evaluate_in_parallel(Graph &g, std::atomic<bool> &stop,
+                              unsigned threads);
+
+    /**
+     * @brief Restrict the calling thread to run on the given CPUs
+     * @details Uses pthread_setaffinity_np, so is a no-op that returns false
+     * on platforms without it.
+     *
+     * @param cpus The CPU numbers the thread may run on
+     * @returns true iff the thread's affinity was changed
+     */
+    bool pin_current_thread(const std::vector<unsigned> &cpus);
+
+    /**
+     * @brief Start a thread that's pinned to the given CPUs and then calls
+     * evaluate_repeatedly on the Graph
+     * @details Before returning, waits for the new thread to pin itself and to
+     * call Graph::reserve with the given number of bytes, so any Nodes built
+     * after this returns are allocated from memory local to the evaluation
+     * thread.
+     *
+     * @param g The graph to evaluate
+     * @param stop Passed to evaluate_repeatedly; join the returned thread
+     * after setting it
+     * @param cpus The CPUs the thread may run on, or empty to not pin it
+     * @param reserve How much Node memory to reserve from the new thread
+     */
+    std::thread start_evaluating(Graph &g, std::atomic<bool> &stop,
+                                 std::vector<unsigned> cpus,
+                                 std::size_t reserve = 0);
+
+#ifdef __linux__
+    /**
+     * @brief Records the values appended to Inputs in an append-only binary
+     * log, so they can be fed into a Graph again later with a Replay
+     * @details Only available on Linux. The log is a memory-mapped file of a
+     * fixed capacity, so
+     * recording a value is an atomic fetch-and-add and a memcpy, without any
+     * system calls. Each record is a Header followed by the value's bytes,
+     * padded to a multiple of 8 bytes. Any number of threads can record
+     * values at the same time. Values that don't fit in the remaining
+     * capacity aren't recorded (but are still passed on), and are counted by
+     * dropped().
+     */
+    class Recorder final {
+      public:
+        /**
+         * @brief The start of each record in the log
+         */
+        struct Header final {
+            /** @brief The channel passed to record() */
+            uint32_t channel;
+            /** @brief The number of bytes in the value, or zero at the end */
+            uint32_t size;
+            /** @brief When the value was recorded, in system_clock nanos */
+            int64_t nanos;
+        };
+
+        /**
+         * @brief The first bytes of every log file
+         */
+        static const uint64_t MAGIC = 0x31474f4c48504743ull; // "CGPHLOG1"
+
+        /**
+         * @brief Create (or truncate) the log file and map capacity bytes
+         * of it into memory
+         * @returns false (with errno set) if the file couldn't be created or
+         * mapped
+         */
+        bool open(const char *path, std::size_t capacity);
+
+        /**
+         * @brief Unmap the log and truncate the file to the records written
+         * @details Mustn't be called while values are being recorded.
+         */
+        void close();
+
+        /**
+         * @brief Wrap an Input so every value appended to the returned Input
+         * is recorded (under the given channel number) before being stored
+         * in the original Input
+         * @details The returned Input schedules the same Node as the original,
+         * and remains valid until the Recorder is destroyed. Values must be
+         * trivially copyable.
+         */
+        template <typename VAL>
+        Input<VAL> record(uint32_t channel, Input<VAL> to) {
+            static_assert(std::is_trivially_copyable<VAL>::value,
+                          "recorded values must be trivially copyable");
+            auto tap = std::make_shared<Tap<VAL>>(*this, channel, to.in);
+            taps.push_back(tap);
+            return Input<VAL>(*tap, to.ref);
+        }
+
+        /**
+         * @brief How many values weren't recorded as the log was full
+         */
+        inline uint64_t dropped() const {
+            return drops.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief How many bytes of the log have been used
+         */
+        inline std::size_t size() const {
+            return std::min(used.load(std::memory_order_relaxed), capacity);
+        }
+
+        Recorder() noexcept : base(nullptr),
+                              capacity(0),
+                              used(0),
+                              drops(0),
+                              fd(-1),
+                              taps() {}
+        Recorder(const Recorder &) = delete;
+        ~Recorder() { close(); }
+
+      private:
+        char *base;
+        std::size_t capacity;
+        std::atomic<std::size_t> used;
+        std::atomic<uint64_t> drops;
+        int fd;
+
+        /**
+         * @brief The Storeables of the Inputs returned by record()
+         */
+        std::vector<std::shared_ptr<void>> taps;
+
+        template <typename VAL>
+        class Tap final : public Storeable<VAL> {
+          public:
+            inline void store(VAL v) override {
+                rec.write(channel, &v, sizeof(VAL));
+                to->store(v);
+            }
+            inline bool try_store(VAL v) override {
+                if (!to->try_store(v))
+                    return false;
+                rec.write(channel, &v, sizeof(VAL));
+                return true;
+            }
+
+            Tap(Recorder &rec, uint32_t channel, Storeable<VAL> *to)
+                : rec(rec), channel(channel), to(to) {}
+
+          private:
+            Recorder &rec;
+            const uint32_t channel;
+            Storeable<VAL> *to;
+        };
+
+        /**
+         * @brief Append a record to the log, if there's room
+         */
+        void write(uint32_t channel, const void *val, uint32_t size);
+    };
+
+    /**
+     * @brief Feeds the values in a log written by a Recorder into a Graph, as
+     * fast as it can
+     * @details Only available on Linux. Maps the whole log into memory, so reading it doesn't make any
+     * system calls. Values are stored to Inputs in the order they were
+     * recorded (which, for values recorded by multiple threads at once, is the
+     * order they reserved space in the log), regardless of their timestamps.
+     */
+    class Replay final {
+      public:
+        /**
+         * @brief Map a log file into memory
+         * @returns false (with errno set) if it couldn't be read, or false if
+         * it isn't a log written by a Recorder
+         */
+        bool open(const char *path);
+
+        /**
+         * @brief Unmap the log
+         */
+        void close();
+
+        /**
+         * @brief Store values recorded under the given channel number to the
+         * given Input
+         * @details Records on channels without an Input are skipped, as are
+         * records whose size doesn't match VAL.
+         */
+        template <typename VAL>
+        void replay(uint32_t channel, Input<VAL> to) {
+            if (feeds.size() <= channel)
+                feeds.resize(channel + 1);
+            feeds[channel].size = sizeof(VAL);
+            feeds[channel].fn = [to](Batch &b, const char *data) {
+                b.append(to, bit_cast<VAL>(data));
+            };
+        }
+
+        /**
+         * @brief Feed the log into the Graph, evaluating it until it's empty
+         * every batch records
+         * @details Values for each batch are stored with a single Batch, so
+         * with a batch size of more than one, successive values for the same
+         * Latest input are conflated just as they are in a live Graph that
+         * can't keep up. Use a batch size of one to evaluate each value in
+         * turn.
+         * @returns The number of records fed into the Graph
+         */
+        std::size_t run(Graph &g, std::size_t batch = 64);
+
+        /**
+         * @brief The timestamp of the last record fed into the Graph by run(),
+         * in system_clock nanos
+         */
+        inline int64_t nanos() const { return last_nanos; }
+
+        Replay() noexcept : base(nullptr), length(0), last_nanos(0), feeds() {}
+        Replay(const Replay &) = delete;
+        ~Replay() { close(); }
+
+      private:
+        const char *base;
+        std::size_t length;
+        int64_t last_nanos;
+
+        struct Feed final {
+            uint32_t size = 0;
+            std::function<void(Batch &, const char *)> fn;
+        };
+        std::vector<Feed> feeds;
+    };
+
+    /**
+     * @brief Saves the state of a set of Nodes to a snapshot file, and
+     * restores it when the Graph's rebuilt (e.g. after a restart)
+     * @details Only available on Linux. Each tracked Node is identified by a
+     * stable key rather than its Work::id, which depends on the order the
+     * Graph's built in. The values in its Latest and Variadic inputs (of
+     * checkpointable types) are saved, as is the last value seen by an
+     * OnChange propagation policy. Nodes whose state is restored are marked
+     * as not needing evaluation, so the first evaluation after a restart
+     * doesn't recalculate the whole Graph. That also means they don't pass
+     * anything on until their inputs next change, so a restored Node's
+     * dependents should be tracked too, or they'll start from their initial
+     * values.
+     */
+    class Checkpoint final {
+      public:
+        /**
+         * @brief Include a Node in the snapshot under the given key
+         */
+        template <typename NODE>
+        void track(std::string key, boost::intrusive_ptr<NODE> node) {
+            NODE *n = node.get();
+            entries.push_back(Entry{
+                std::move(key), node,
+                [n](std::string &out) { n->save_state(out); },
+                [n](const char *first, const char *last) {
+                    return n->restore_state(first, last);
+                }});
+        }
+
+        /**
+         * @brief Write the state of the tracked Nodes to a snapshot file
+         * @details Writes to a temporary file next to it, syncs it to disk and
+         * then renames it (syncing the directory too), so even a crash never
+         * leaves a half-written snapshot. The Graph can be evaluated at
+         * the same time, but each Node's state is saved at a different point
+         * in time.
+         * @returns false (with errno set) if the file couldn't be written
+         */
+        bool save(const char *path) const;
+
+        /**
+         * @brief Map a snapshot file into memory, and restore the state of
+         * the tracked Nodes with keys in it
+         * @details Call after the Graph's built, but before it's evaluated or
+         * any values are appended to it. Keys in the snapshot that aren't
+         * tracked are ignored.
+         * @returns How many Nodes were restored
+         */
+        std::size_t restore(const char *path);
+
+        /**
+         * @brief The first bytes of every snapshot file
+         */
+        static const uint64_t MAGIC = 0x31504b4348504743ull; // "CGPHCKP1"
+
+      private:
+        struct Entry final {
+            std::string key;
+            boost::intrusive_ptr<Work> node;
+            std::function<void(std::string &)> save;
+            std::function<bool(const char *, const char *)> restore;
+        };
+        std::vector<Entry> entries;
+    };
+#endif
 }
 
 #endif
\ No newline at end of file
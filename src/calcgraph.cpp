@@ -1,91 +1,652 @@
 
 #include "calcgraph.h"
 
+#include <cerrno>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace calcgraph {
 
+    /**
+     * @brief A block of memory an Arena allocates objects from
+     * @details The memory for the objects immediately follows this struct.
+     */
+    struct alignas(std::max_align_t) Arena::Chunk {
+        std::atomic<std::size_t> refs;
+        std::size_t used;
+        const std::size_t size;
+
+        /**
+         * @brief The next spare chunk, if this one's in Arena::spare
+         */
+        Chunk *next;
+
+        Chunk(std::size_t size) : refs(1), used(0), size(size), next(nullptr) {}
+
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+
+        static Chunk *create(std::size_t size) {
+            return new (::operator new(sizeof(Chunk) + size)) Chunk(size);
+        }
+
+        void release() {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                this->~Chunk();
+                ::operator delete(this);
+            }
+        }
+    };
+
+    /**
+     * @brief The size of the chunks an Arena allocates from the heap
+     */
+    static const std::size_t ARENA_CHUNK = 64 * 1024;
+
+    void *Arena::allocate(std::size_t size) {
+        const std::size_t align = alignof(std::max_align_t);
+        const std::size_t total =
+            sizeof(Header) + (size + align - 1) / align * align;
+
+        Chunk *chunk;
+        char *where;
+        if (total > ARENA_CHUNK / 4) {
+            // too big to share a chunk, so give it its own (and this
+            // allocation's reference is the chunk's only one)
+            chunk = Chunk::create(total);
+            chunk->used = total;
+            where = chunk->data();
+        } else {
+            while (lock.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            if (!current || current->used + total > current->size) {
+                if (current)
+                    current->release();
+                if (spare) {
+                    current = spare;
+                    spare = spare->next;
+                } else {
+                    current = Chunk::create(ARENA_CHUNK);
+                }
+            }
+            chunk = current;
+            chunk->refs.fetch_add(1, std::memory_order_relaxed);
+            where = chunk->data() + chunk->used;
+            chunk->used += total;
+            lock.clear(std::memory_order_release);
+        }
+
+        Header *h = reinterpret_cast<Header *>(where);
+        h->chunk = chunk;
+        return h + 1;
+    }
+
+    void *Arena::allocate_unpooled(std::size_t size) {
+        Header *h = static_cast<Header *>(::operator new(sizeof(Header) + size));
+        h->chunk = nullptr;
+        return h + 1;
+    }
+
+    void Arena::deallocate(void *p) {
+        if (!p)
+            return;
+        Header *h = static_cast<Header *>(p) - 1;
+        if (h->chunk)
+            h->chunk->release();
+        else
+            ::operator delete(h);
+    }
+
+    void Arena::reserve(std::size_t bytes) {
+#ifdef __linux__
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+#else
+        const std::size_t page = 4096;
+#endif
+        for (std::size_t reserved = 0; reserved < bytes;
+             reserved += ARENA_CHUNK) {
+            Chunk *chunk = Chunk::create(ARENA_CHUNK);
+
+            // write to every page so they're placed on our NUMA node now,
+            // rather than when a (possibly remote) builder thread first uses
+            // them
+            volatile char *data = chunk->data();
+            for (std::size_t i = 0; i < ARENA_CHUNK; i += page) {
+                data[i] = 0;
+            }
+
+            while (lock.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            chunk->next = spare;
+            spare = chunk;
+            lock.clear(std::memory_order_release);
+        }
+    }
+
+    Arena::~Arena() {
+        if (current)
+            current->release();
+        while (spare) {
+            Chunk *next = spare->next;
+            spare->release();
+            spare = next;
+        }
+    }
+
+    namespace {
+        /**
+         * @brief Guards which Epochs are still alive, for threads giving up
+         * their Records as they exit
+         * @details Both leaked, so they outlive every thread_local.
+         */
+        std::mutex &epochs_lock() {
+            static std::mutex *lock = new std::mutex();
+            return *lock;
+        }
+        std::unordered_set<uint64_t> &live_epochs() {
+            static auto *live = new std::unordered_set<uint64_t>();
+            return *live;
+        }
+        std::atomic<uint64_t> epoch_ids(1);
+    }
+
+    struct Epoch::Record {
+        /**
+         * @brief The epoch this thread pinned (shifted left one bit, with the
+         * bottom bit set) or zero if it's not pinned
+         */
+        std::atomic<uint64_t> announced;
+
+        /**
+         * @brief Whether a live thread is using this Record
+         */
+        std::atomic<bool> owned;
+        Record *next;
+
+        // only accessed by the owning thread
+        uint32_t depth;
+
+        Record() : announced(0), owned(true), next(nullptr), depth(0) {}
+    };
+
+    struct Epoch::Retired {
+        void *p;
+        void (*deleter)(void *);
+        uint64_t epoch;
+        Retired *next;
+
+        static void *operator new(std::size_t) {
+            return Pool<Retired>::allocate();
+        }
+        static void operator delete(void *p) { Pool<Retired>::deallocate(p); }
+    };
+
+    /**
+     * @brief The calling thread's Record in each live Epoch it's pinned,
+     * given up when the thread exits
+     */
+    struct Epoch::Local {
+        struct Entry {
+            uint64_t id;
+            Record *record;
+        };
+        std::vector<Entry> entries;
+
+        /**
+         * @brief Forget the Records of Epochs that have been destroyed; must
+         * hold epochs_lock
+         */
+        void prune() {
+            auto &live = live_epochs();
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                         [&live](const Entry &e) {
+                                             return !live.count(e.id);
+                                         }),
+                          entries.end());
+        }
+
+        ~Local() {
+            std::lock_guard<std::mutex> hold(epochs_lock());
+            prune();
+            for (auto &e : entries) {
+                e.record->announced.store(0, std::memory_order_release);
+                e.record->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    Epoch::Epoch()
+        : id(epoch_ids.fetch_add(1, std::memory_order_relaxed)), global(1),
+          records(nullptr), retired(nullptr), retired_since_collect(0),
+          outstanding(0) {
+        std::lock_guard<std::mutex> hold(epochs_lock());
+        live_epochs().insert(id);
+    }
+
+    Epoch::~Epoch() {
+        {
+            std::lock_guard<std::mutex> hold(epochs_lock());
+            live_epochs().erase(id);
+        }
+        Record *r = records.load(std::memory_order_acquire);
+        while (r) {
+            Record *next = r->next;
+            delete r;
+            r = next;
+        }
+
+        // the deleters might retire more values
+        while (!limbo.empty() || retired.load(std::memory_order_acquire)) {
+            for (Retired *x = retired.exchange(nullptr); x; x = x->next) {
+                limbo.push_back(x);
+            }
+            freeing.swap(limbo);
+            for (Retired *x : freeing) {
+                x->deleter(x->p);
+                delete x;
+            }
+            freeing.clear();
+        }
+    }
+
+    Epoch &Epoch::shared() {
+        // leaked, so it outlives every thread_local
+        static Epoch *shared = new Epoch();
+        return *shared;
+    }
+
+    Epoch::Record &Epoch::local() {
+        static thread_local Local cache;
+        for (auto &e : cache.entries) {
+            if (e.id == id)
+                return *e.record;
+        }
+
+        // first time this thread's pinned this Epoch
+        std::lock_guard<std::mutex> hold(epochs_lock());
+        cache.prune();
+        Record *found = nullptr;
+        for (Record *r = records.load(std::memory_order_acquire); r && !found;
+             r = r->next) {
+            bool owned = false;
+            if (!r->owned.load(std::memory_order_relaxed) &&
+                r->owned.compare_exchange_strong(owned, true,
+                                                 std::memory_order_acquire))
+                found = r;
+        }
+        if (!found) {
+            found = new Record();
+            found->next = records.load(std::memory_order_relaxed);
+            while (!records.compare_exchange_weak(found->next, found,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+            }
+        }
+        cache.entries.push_back(Local::Entry{id, found});
+        return *found;
+    }
+
+    void Epoch::pin() {
+        Record &r = local();
+        if (r.depth++ == 0) {
+            r.announced.store(global.load(std::memory_order_relaxed) << 1 | 1,
+                              std::memory_order_relaxed);
+            // make sure our announcement's visible before we read anything
+            // the epoch protects
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void Epoch::unpin() {
+        Record &r = local();
+        if (--r.depth == 0)
+            r.announced.store(0, std::memory_order_release);
+    }
+
+    void Epoch::retire(void *p, void (*deleter)(void *)) {
+        // count it first so a racing collect can't take the count negative
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        Retired *x = new Retired{p, deleter,
+                                 global.load(std::memory_order_seq_cst),
+                                 retired.load(std::memory_order_relaxed)};
+        while (!retired.compare_exchange_weak(x->next, x,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+        }
+        if (retired_since_collect.fetch_add(1, std::memory_order_relaxed) >=
+            63)
+            collect();
+    }
+
+    void Epoch::collect() {
+        if (!outstanding.load(std::memory_order_relaxed) ||
+            collecting.test_and_set(std::memory_order_acquire))
+            return;
+        retired_since_collect.store(0, std::memory_order_relaxed);
+        for (Retired *x = retired.exchange(nullptr, std::memory_order_acquire);
+             x; x = x->next) {
+            limbo.push_back(x);
+        }
+        if (limbo.empty()) {
+            collecting.clear(std::memory_order_release);
+            return;
+        }
+
+        // the epoch can advance once every pinned thread has seen it
+        uint64_t current = global.load(std::memory_order_seq_cst);
+        bool advance = true;
+        for (Record *other = records.load(std::memory_order_acquire); other;
+             other = other->next) {
+            uint64_t a = other->announced.load(std::memory_order_seq_cst);
+            if ((a & 1) && (a >> 1) != current) {
+                advance = false;
+                break;
+            }
+        }
+        if (advance &&
+            global.compare_exchange_strong(current, current + 1,
+                                           std::memory_order_seq_cst))
+            ++current;
+
+        // anything retired two epochs ago can't be referenced by a pinned
+        // thread. Move them out first, as the deleters might retire more.
+        auto safe = std::partition(
+            limbo.begin(), limbo.end(),
+            [current](const Retired *x) { return x->epoch + 2 > current; });
+        freeing.assign(safe, limbo.end());
+        limbo.erase(safe, limbo.end());
+        for (Retired *x : freeing) {
+            x->deleter(x->p);
+            delete x;
+        }
+        outstanding.fetch_sub(freeing.size(), std::memory_order_relaxed);
+        freeing.clear();
+        collecting.clear(std::memory_order_release);
+    }
+
     void WorkState::add_to_queue(Work &work) {
         // note that the or-equals part of the check is important; if we
-        // failed to calculate work this time then Work::id ==
-        // WorkState::current_id, and we want to put the work back on the graph
-        // queue for later evaluation.
-        if (work.id <= current_id) {
+        // failed to calculate work this time then Work::rank ==
+        // WorkState::current_rank, and we want to put the work back on the
+        // graph queue for later evaluation.
+        if (work.rank() <= current_rank) {
             // process it next Graph()
-            work.schedule(g);
-
-            if (stats)
-                stats->pushed_graph++;
+            if (fanout_depth)
+                g.chain(work, chain_first, chain_tail);
+            else
+                work.schedule(g);
+            counts.pushed_graph++;
         } else {
             // keep anything around that's going on the heap - we remove a
             // reference after popping them off the heap and eval()'ing them
             intrusive_ptr_add_ref(&work);
+            work.metrics_scheduled();
+
+            if (fanout_depth) {
+                // end_fanout has a single fence for the whole batch
+                work.dirty.store(true, std::memory_order_release);
+                pending.push_back(&work);
+            } else {
+                work.dirty.store(true, std::memory_order_seq_cst);
+                push(&work);
+            }
+            counts.pushed_heap++;
+        }
+    }
+
+    void WorkState::end_fanout() {
+        if (--fanout_depth)
+            return;
+
+        if (!pending.empty()) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // dependents are usually built after (so have higher ids than)
+            // what's on the heap, so each push_heap is cheap; it's the
+            // per-push fence we're saving
+            for (Work *w : pending) {
+                q.push_back(w);
+                std::push_heap(q.begin(), q.end(), WorkQueueCmp());
+            }
+            pending.clear();
+        }
+
+        if (chain_first) {
+            g.splice(chain_first, chain_tail);
+            chain_first = chain_tail = nullptr;
+        }
+    }
+
+    void WorkState::invalidated(Work &work) {
+        intrusive_ptr_add_ref(&work);
+        while (g.stale_lock.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        g.stale.push_back(&work);
+        g.stale_lock.clear(std::memory_order_release);
+    }
 
-            q.push(&work);
+    void WorkState::push(Work *w) {
+        q.push_back(w);
+        std::push_heap(q.begin(), q.end(), WorkQueueCmp());
+    }
+
+    Work *WorkState::pop() {
+        Work *w = nullptr;
+        if (!q.empty()) {
+            std::pop_heap(q.begin(), q.end(), WorkQueueCmp());
+            w = q.back();
+            q.pop_back();
 
-            if (stats)
-                stats->pushed_heap++;
+            // remove any duplicates, we only need to
+            // calculate things once.
+            while (!q.empty() && q.front()->id == w->id) {
+                std::pop_heap(q.begin(), q.end(), WorkQueueCmp());
+                intrusive_ptr_release(q.back());
+                q.pop_back();
+                counts.duplicates++;
+            }
         }
+        return w;
     }
 
     constexpr bool WorkQueueCmp::operator()(const Work *a,
                                             const Work *b) const {
-        return a->id > b->id;
+        return a->rank() > b->rank();
     }
 
+    namespace {
+        /**
+         * @brief The stats policy for Graph::run that doesn't record anything
+         */
+        struct NoStats final {
+            inline void drained(uint64_t) {}
+            inline void depth(std::size_t) {}
+            inline void finish(const struct Stats &) {}
+        };
+
+        /**
+         * @brief The stats policy for Graph::run that records a Stats object
+         */
+        struct TotalStats final {
+            struct Stats *out;
+            inline void drained(uint64_t) {}
+            inline void depth(std::size_t) {}
+            inline void finish(const struct Stats &counts) { *out = counts; }
+        };
+
+        /**
+         * @brief The stats policy for Graph::run that records a FullStats
+         * object
+         */
+        struct HistogramStats final {
+            struct FullStats *out;
+            inline void drained(uint64_t n) {
+                out->drained[FullStats::bucket(n)]++;
+            }
+            inline void depth(std::size_t n) {
+                out->heap_depth[FullStats::bucket(n)]++;
+            }
+            inline void finish(const struct Stats &counts) {
+                out->totals = counts;
+            }
+        };
+    }
+
+    bool Graph::operator()() { return run(NoStats()); }
+
     bool Graph::operator()(struct Stats *stats) {
-        if (stats)
-            *stats = EmptyStats;
+        if (!stats)
+            return run(NoStats());
+        *stats = EmptyStats;
+        return run(TotalStats{stats});
+    }
+
+    bool Graph::operator()(struct FullStats *stats) {
+        if (!stats)
+            return run(NoStats());
+        *stats = FullStats{};
+        return run(HistogramStats{stats});
+    }
 
+    template <typename STATS>
+    bool Graph::run(STATS stats) {
+        drain_channels();
+        fire_timers();
         auto head = work_queue.exchange(&tombstone, std::memory_order_acq_rel);
-        if (head == &tombstone)
+        if (head == &tombstone) {
+            // still a quiescent point, so values replaced while we're idle
+            // don't wait for the next evaluation
+            epoch.collect();
+            Epoch::shared().collect();
             return false;
+        }
 
-        WorkState work(*this, stats);
+        {
+            // pin once for the whole evaluation, so Input policies' reads
+            // don't have to
+            Epoch::Guard pinned(epoch);
+
+            if (evaluating.test_and_set(std::memory_order_acquire)) {
+                // someone else is using the reusable heap
+                WorkState work(*this);
+                evaluate(head, work, stats);
+            } else {
+                reusable.counts = EmptyStats;
+                evaluate(head, reusable, stats);
+                evaluating.clear(std::memory_order_release);
+            }
+        }
+
+        // a quiescent point, so free values replaced a couple of
+        // evaluations ago
+        epoch.collect();
+        Epoch::shared().collect();
+
+        return true;
+    }
+
+    template <typename STATS>
+    void Graph::evaluate(Work *head, WorkState &work, STATS &stats) {
         Work *w = head;
         while (w != &tombstone) {
-            // remove us from the work queue. Note that this is slightly
-            // inefficient, as w could be put back on the Graph's work_queue
-            // before it's been evaluated in this function call, and so is
-            // needlessly evaluated a second time.
+            // remove us from the work queue. Note that w could be put back on
+            // the Graph's work_queue before it's been evaluated in this
+            // function call; we'll use the dirty flag to skip it if so.
             Work *next = w->dequeue();
 
-            work.q.push(w);
-            if (stats)
-                stats->queued++;
+            work.push(w);
+            work.counts.queued++;
 
             w = next;
         }
+        stats.drained(work.counts.queued);
 
-        while (!work.q.empty()) {
-
-            Work *w = work.q.top();
-            work.q.pop();
+        // only look at the clock if a lane has a budget. Each lane's clock
+        // starts when we pop its first Work, and a lane isn't cut off until
+        // it's evaluated something; a negative limit means the lane's used
+        // its budget up
+        struct {
+            int64_t limit;
+            std::chrono::steady_clock::time_point started;
+            bool timing;
+            bool progressed;
+        } lanes[PRIORITIES];
+        bool budgeted = false;
+        for (std::size_t i = 0; i < PRIORITIES; ++i) {
+            lanes[i].limit = budgets[i].load(std::memory_order_relaxed);
+            lanes[i].timing = false;
+            lanes[i].progressed = false;
+            budgeted |= lanes[i].limit != 0;
+        }
 
-            // remove any duplicates, we only need to
-            // calculate things once.
-            while (!work.q.empty() && work.q.top()->id == w->id) {
-                intrusive_ptr_release(work.q.top());
-                work.q.pop();
-                if (stats)
-                    stats->duplicates++;
+        while ((w = work.pop()) != nullptr) {
+            stats.depth(work.q.size());
+            auto &lane = lanes[static_cast<std::size_t>(w->lane)];
+            if (budgeted && lane.limit > 0) {
+                auto now = std::chrono::steady_clock::now();
+                if (!lane.timing) {
+                    lane.started = now;
+                    lane.timing = true;
+                } else if (lane.progressed &&
+                           now - lane.started >
+                               std::chrono::nanoseconds(lane.limit)) {
+                    lane.limit = -1;
+                }
+            }
+            if (lane.limit < 0) {
+                // leave it (still dirty) for the next evaluation
+                w->schedule(*this);
+                work.counts.deferred++;
+                intrusive_ptr_release(w);
+                continue;
             }
 
-            work.current_id = w->id;
-            w->eval(work);
-            if (stats)
-                stats->worked++;
+            if (w->clean()) {
+                work.current_rank = w->rank();
+                work.current = w;
+                w->eval(work);
+                work.counts.worked++;
+                lane.progressed = true;
+            } else {
+                work.counts.redundant++;
+            }
 
             // finally finished with this Work - it's not on the Graph queue
             // or the heap
             intrusive_ptr_release(w);
         }
 
-        return true;
+        stats.finish(work.counts);
     }
 
     void Work::schedule(Graph &g) {
         if (id == flags::DONT_SCHEDULE)
             return;
 
+        // must happen before we check if we're already queued, so whoever
+        // dequeues us knows to eval() us
+        dirty.store(true, std::memory_order_seq_cst);
+        metrics_scheduled();
+
         // don't want work to be deleted while queued
         intrusive_ptr_add_ref(this);
 
@@ -111,7 +672,10 @@ namespace calcgraph {
             }
 
             if (g.work_queue.compare_exchange_weak(head, this)) {
-                // success! but keep the intrustive reference active
+                // success! but keep the intrustive reference active. If the
+                // queue was empty an evaluation thread may be waiting for us.
+                if (head == &g.tombstone)
+                    g.wake();
                 return;
             }
 
@@ -123,10 +687,247 @@ namespace calcgraph {
         }
     }
 
+    bool Work::claim(Work *successor) {
+        if (id == flags::DONT_SCHEDULE)
+            return false;
+
+        // as in schedule, must happen before we check if we're already queued
+        dirty.store(true, std::memory_order_seq_cst);
+        metrics_scheduled();
+
+        intrusive_ptr_add_ref(this);
+        std::uintptr_t current = next.load(std::memory_order_acquire);
+        while (!(current & ~flags::LOCK)) {
+            // keep the lock bit, as the Work might be being eval()'ed
+            if (next.compare_exchange_weak(
+                    current, reinterpret_cast<std::uintptr_t>(successor) |
+                                 (current & flags::LOCK)))
+                return true;
+        }
+
+        // already on a work_queue or in a Batch
+        intrusive_ptr_release(this);
+        return false;
+    }
+
+    void Graph::chain(Work &w, Work *&first, Work *&tail) {
+        // the first Work claimed is the tail of the chain, so temporarily
+        // points to the tombstone (any non-null pointer would do) to show it's
+        // claimed
+        if (w.claim(first ? first : &tombstone)) {
+            if (!first)
+                tail = &w;
+            first = &w;
+        }
+    }
+
+    void Graph::splice(Work *first, Work *tail) {
+        Work *head = work_queue.load(std::memory_order_acquire);
+        while (true) {
+            // point the tail of our chain at the head of the queue, keeping
+            // its lock bit
+            std::uintptr_t current = tail->next.load(std::memory_order_acquire);
+            while (!tail->next.compare_exchange_weak(
+                current, reinterpret_cast<std::uintptr_t>(head) |
+                             (current & flags::LOCK))) {
+            }
+
+            if (work_queue.compare_exchange_weak(head, first))
+                break;
+        }
+
+        if (head == &tombstone)
+            wake();
+    }
+
+    void Batch::add(Work &w) { g.chain(w, first, tail); }
+
+    void Batch::commit() {
+        if (!first)
+            return;
+        g.splice(first, tail);
+        first = tail = nullptr;
+    }
+
+    void Graph::pull() {
+        while (true) {
+            while ((*this)()) {
+            }
+
+            // recalculate the lowest-id stale Node, as its results may make
+            // higher-id ones stale
+            Work *w = nullptr;
+            while (stale_lock.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            if (!stale.empty()) {
+                auto lowest = std::min_element(
+                    stale.begin(), stale.end(),
+                    [](Work *a, Work *b) { return a->id < b->id; });
+                w = *lowest;
+                *lowest = stale.back();
+                stale.pop_back();
+            }
+            stale_lock.clear(std::memory_order_release);
+
+            if (!w)
+                return;
+            w->refresh(*this);
+            intrusive_ptr_release(w);
+        }
+    }
+
+    void Graph::schedule_at(Work &w,
+                            std::chrono::steady_clock::time_point when) {
+        intrusive_ptr_add_ref(&w);
+        while (timer_lock.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        timers.emplace_back(when, &w);
+        std::push_heap(timers.begin(), timers.end(), TimerCmp());
+        next_timer.store(timers.front().first.time_since_epoch().count(),
+                         std::memory_order_release);
+        timer_lock.clear(std::memory_order_release);
+
+        // a parked evaluation thread needs to wake up earlier
+        wake();
+    }
+
+    void Graph::fire_timers() {
+        int64_t due = next_timer.load(std::memory_order_acquire);
+        if (due == NO_TIMER ||
+            std::chrono::steady_clock::now().time_since_epoch().count() < due)
+            return;
+
+        while (timer_lock.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        auto now = std::chrono::steady_clock::now();
+        while (!timers.empty() && timers.front().first <= now) {
+            std::pop_heap(timers.begin(), timers.end(), TimerCmp());
+            Work *w = timers.back().second;
+            timers.pop_back();
+            w->schedule(*this);
+            intrusive_ptr_release(w);
+        }
+        next_timer.store(timers.empty()
+                             ? NO_TIMER
+                             : timers.front().first.time_since_epoch().count(),
+                         std::memory_order_release);
+        timer_lock.clear(std::memory_order_release);
+    }
+
+    void Graph::budget(Priority lane, std::chrono::nanoseconds limit) {
+        budgets[static_cast<std::size_t>(lane)].store(
+            limit.count(), std::memory_order_relaxed);
+    }
+
+    bool Graph::compact(const std::vector<Work *> &roots) {
+        // find everything reachable from the roots, and their connections
+        std::vector<Work *> nodes;
+        std::vector<std::vector<Work *>> edges;
+        std::unordered_map<Work *, std::size_t> index;
+        std::vector<Work *> stack(roots.begin(), roots.end());
+        while (!stack.empty()) {
+            Work *w = stack.back();
+            stack.pop_back();
+            // embedded functions aren't evaluated, so don't need ids
+            if (!w || w->id == flags::DONT_SCHEDULE || index.count(w))
+                continue;
+            index.emplace(w, nodes.size());
+            nodes.push_back(w);
+            edges.emplace_back();
+            w->collect_dependents(edges.back());
+            stack.insert(stack.end(), edges.back().begin(),
+                         edges.back().end());
+        }
+
+        // Kahn's algorithm, taking the lowest old id whenever there's a choice
+        std::vector<uint32_t> indegree(nodes.size(), 0);
+        for (auto &out : edges) {
+            for (Work *d : out) {
+                auto found = index.find(d);
+                if (found != index.end())
+                    indegree[found->second]++;
+            }
+        }
+        using entry = std::pair<uint32_t, std::size_t>;
+        std::priority_queue<entry, std::vector<entry>, std::greater<entry>>
+            ready;
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            if (indegree[i] == 0)
+                ready.emplace(nodes[i]->id, i);
+        }
+        std::vector<std::size_t> order;
+        order.reserve(nodes.size());
+        while (!ready.empty()) {
+            std::size_t i = ready.top().second;
+            ready.pop();
+            order.push_back(i);
+            for (Work *d : edges[i]) {
+                auto found = index.find(d);
+                if (found != index.end() && --indegree[found->second] == 0)
+                    ready.emplace(d->id, found->second);
+            }
+        }
+        if (order.size() != nodes.size())
+            return false;
+
+        // hand out fresh ids, so the reached Nodes come after every Node
+        // that wasn't reached (which might be upstream of them). Wrapping
+        // round would put them before everything (or on DONT_SCHEDULE).
+        uint32_t first = ids.load(std::memory_order_relaxed);
+        do {
+            if (nodes.size() > std::numeric_limits<uint32_t>::max() - first)
+                return false;
+        } while (!ids.compare_exchange_weak(
+            first, first + static_cast<uint32_t>(nodes.size()),
+            std::memory_order_relaxed));
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            Work *w = nodes[order[i]];
+            w->id = first + static_cast<uint32_t>(i);
+#ifdef CALCGRAPH_METRICS
+            w->counters->id.store(w->id, std::memory_order_relaxed);
+#endif
+        }
+        return true;
+    }
+
+    void WorkState::defer(std::chrono::steady_clock::time_point when) {
+        if (current)
+            g.schedule_at(*current, when);
+    }
+
+    Batch Graph::batch() { return Batch(*this); }
+
     NodeBuilder<Always, SingleList> Graph::node() {
         return NodeBuilder<Always, SingleList>(*this);
     }
 
+#ifdef CALCGRAPH_METRICS
+    std::vector<NodeMetrics> Graph::metrics() {
+        std::vector<NodeMetrics> ret;
+        while (tracking.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        // drop the metrics of any Nodes that have been destroyed
+        auto expired = [](const std::weak_ptr<Work::Counters> &c) {
+            return c.expired();
+        };
+        tracked.erase(std::remove_if(tracked.begin(), tracked.end(), expired),
+                      tracked.end());
+        ret.reserve(tracked.size());
+        for (auto &weak : tracked) {
+            if (auto counters = weak.lock())
+                ret.push_back(counters->snapshot());
+        }
+
+        tracking.clear(std::memory_order_release);
+        return ret;
+    }
+#endif
+
     void evaluate_repeatedly(Graph &g, std::atomic<bool> &stop) {
         while (!stop.load(std::memory_order_consume)) {
             while (g()) {
@@ -134,4 +935,559 @@ namespace calcgraph {
             std::this_thread::yield();
         }
     }
+
+    void Graph::park(std::chrono::milliseconds timeout) {
+        // don't sleep past the next timer
+        int64_t due = next_timer.load(std::memory_order_acquire);
+        if (due != NO_TIMER) {
+            auto until = std::chrono::steady_clock::time_point(
+                             std::chrono::steady_clock::duration(due)) -
+                         std::chrono::steady_clock::now();
+            if (until <= std::chrono::steady_clock::duration::zero())
+                return;
+            if (until < timeout)
+                timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    until + std::chrono::milliseconds(1) -
+                    std::chrono::nanoseconds(1));
+        }
+
+        // announce we're about to sleep *before* checking the queue, so a
+        // concurrent Work::schedule either sees parked set or we see its Work
+        parked.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t seen = wakeups.load(std::memory_order_seq_cst);
+        if (work_queue.load(std::memory_order_seq_cst) == &tombstone &&
+            !channels_pending()) {
+#ifdef __linux__
+            auto secs =
+                std::chrono::duration_cast<std::chrono::seconds>(timeout);
+            struct timespec ts;
+            ts.tv_sec = secs.count();
+            ts.tv_nsec =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(timeout -
+                                                                     secs)
+                    .count();
+            // returns immediately if unpark() has been called since we read
+            // the wakeups counter
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&wakeups),
+                    FUTEX_WAIT_PRIVATE, seen, &ts, nullptr, 0);
+#else
+            std::this_thread::yield();
+#endif
+        }
+        parked.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool Graph::channels_pending() const {
+        for (ChannelBase *c = channels.load(std::memory_order_seq_cst); c;
+             c = c->next) {
+            if (!c->empty())
+                return true;
+        }
+        return false;
+    }
+
+    void Graph::unpark() {
+        wakeups.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&wakeups),
+                FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    void evaluate_or_park(Graph &g, std::atomic<bool> &stop, uint32_t spins,
+                          std::chrono::milliseconds timeout) {
+        uint32_t idle = 0;
+        while (!stop.load(std::memory_order_consume)) {
+            if (g()) {
+                while (g()) {
+                }
+                idle = 0;
+            } else if (++idle < spins) {
+                std::this_thread::yield();
+            } else {
+                g.park(timeout);
+                idle = 0;
+            }
+        }
+    }
+
+    bool pin_current_thread(const std::vector<unsigned> &cpus) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned cpu : cpus) {
+            if (cpu >= CPU_SETSIZE)
+                return false;
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    std::thread start_evaluating(Graph &g, std::atomic<bool> &stop,
+                                 std::vector<unsigned> cpus,
+                                 std::size_t reserve) {
+        std::promise<void> ready;
+        std::future<void> started = ready.get_future();
+        std::thread t([&g, &stop, &ready, cpus, reserve]() {
+            if (!cpus.empty())
+                pin_current_thread(cpus);
+            if (reserve)
+                g.reserve(reserve);
+            ready.set_value();
+            evaluate_repeatedly(g, stop);
+        });
+        started.wait();
+        return t;
+    }
+
+    namespace {
+        const std::size_t NO_SLOT = SIZE_MAX;
+
+        /**
+         * @brief Splits the Work taken off a Graph's work_queue into
+         * subgraphs that share no dependents, for evaluate_in_parallel
+         * @details A union-find over everything reachable from the Work
+         * items; its containers are reused between evaluations.
+         */
+        class Partitioner final {
+          public:
+            /**
+             * @brief Group the given Work items into parts, so that two items
+             * with a (transitive) dependent in common are in the same part
+             * @returns How many of the parts are used; the rest are empty
+             */
+            std::size_t split(const std::vector<Work *> &items,
+                              std::vector<std::vector<Work *>> &parts) {
+                sets.clear();
+                owner.clear();
+                item_sets.clear();
+                for (Work *item : items) {
+                    std::size_t set = sets.size();
+                    sets.push_back(set);
+                    item_sets.push_back(set);
+                    stack.assign(1, item);
+                    while (!stack.empty()) {
+                        Work *w = stack.back();
+                        stack.pop_back();
+                        auto found = owner.find(w);
+                        if (found != owner.end()) {
+                            // already walked from an earlier item
+                            merge(set, found->second);
+                            continue;
+                        }
+                        owner.emplace(w, set);
+                        w->collect_dependents(stack);
+                    }
+                }
+
+                slots.assign(sets.size(), NO_SLOT);
+                std::size_t used = 0;
+                for (std::size_t i = 0; i < items.size(); ++i) {
+                    std::size_t &slot = slots[find(item_sets[i])];
+                    if (slot == NO_SLOT) {
+                        slot = used++;
+                        if (parts.size() < used)
+                            parts.emplace_back();
+                        parts[slot].clear();
+                    }
+                    parts[slot].push_back(items[i]);
+                }
+                return used;
+            }
+
+          private:
+            std::size_t find(std::size_t set) {
+                while (sets[set] != set) {
+                    sets[set] = sets[sets[set]];
+                    set = sets[set];
+                }
+                return set;
+            }
+            void merge(std::size_t a, std::size_t b) {
+                a = find(a);
+                b = find(b);
+                if (a != b)
+                    sets[std::max(a, b)] = std::min(a, b);
+            }
+
+            /** @brief Each set's parent in the union-find */
+            std::vector<std::size_t> sets;
+            /** @brief The set each reached Work item was first reached by */
+            std::unordered_map<Work *, std::size_t> owner;
+            /** @brief The set each item started */
+            std::vector<std::size_t> item_sets;
+            /** @brief Each set's part (if it's a root) */
+            std::vector<std::size_t> slots;
+            std::vector<Work *> stack;
+        };
+    }
+
+    void evaluate_in_parallel(Graph &g, std::atomic<bool> &stop,
+                              unsigned threads) {
+        if (threads < 1)
+            threads = 1;
+
+        // each thread's heap, reused every evaluation
+        std::vector<std::unique_ptr<WorkState>> workers;
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back(new WorkState(g));
+        }
+
+        // the current evaluation's independent subgraphs, handed out to
+        // whichever thread asks next
+        std::vector<std::vector<Work *>> parts;
+        std::size_t used = 0;
+        std::atomic<std::size_t> next_part(0);
+        std::atomic<unsigned> busy(0);
+        std::atomic<uint64_t> generation(0);
+        std::atomic<bool> done(false);
+
+        auto evaluate_parts = [&](unsigned self) {
+            WorkState &work = *workers[self];
+            std::size_t i;
+            while ((i = next_part.fetch_add(1, std::memory_order_relaxed)) <
+                   used) {
+                for (Work *w : parts[i]) {
+                    work.push(w);
+                }
+                Work *w;
+                while ((w = work.pop()) != nullptr) {
+                    if (w->clean()) {
+                        Epoch::Guard pinned(g.epoch);
+                        work.current_rank = w->rank();
+                        work.current = w;
+                        w->eval(work);
+                    }
+                    intrusive_ptr_release(w);
+                }
+            }
+        };
+
+        // the other threads wait for each evaluation to start, and say when
+        // they've run out of subgraphs
+        auto run = [&](unsigned self) {
+            uint64_t seen = 0;
+            while (true) {
+                uint64_t latest;
+                while ((latest = generation.load(std::memory_order_acquire)) ==
+                       seen) {
+                    if (done.load(std::memory_order_acquire))
+                        return;
+                    std::this_thread::yield();
+                }
+                seen = latest;
+                evaluate_parts(self);
+                busy.fetch_sub(1, std::memory_order_release);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i) {
+            pool.emplace_back(run, i);
+        }
+
+        // this thread takes the Graph's work_queue and splits it up
+        Partitioner partitioner;
+        std::vector<Work *> items;
+        while (!stop.load(std::memory_order_consume)) {
+            g.drain_channels();
+            g.fire_timers();
+            Work *head =
+                g.work_queue.exchange(&g.tombstone, std::memory_order_acq_rel);
+            if (head == &g.tombstone) {
+                std::this_thread::yield();
+                continue;
+            }
+            items.clear();
+            while (head != &g.tombstone) {
+                Work *next = head->dequeue();
+                items.push_back(head);
+                head = next;
+            }
+
+            used = partitioner.split(items, parts);
+            next_part.store(0, std::memory_order_relaxed);
+            busy.store(threads, std::memory_order_relaxed);
+            generation.fetch_add(1, std::memory_order_release);
+            evaluate_parts(0);
+            busy.fetch_sub(1, std::memory_order_acq_rel);
+            while (busy.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            g.epoch.collect();
+            Epoch::shared().collect();
+        }
+
+        done.store(true, std::memory_order_release);
+        for (auto &t : pool) {
+            t.join();
+        }
+    }
+
+#ifdef __linux__
+    const uint64_t Recorder::MAGIC;
+    const uint64_t Checkpoint::MAGIC;
+
+    bool Recorder::open(const char *path, std::size_t cap) {
+        close();
+        if (cap < sizeof(MAGIC)) {
+            errno = EINVAL;
+            return false;
+        }
+
+        int f = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (f < 0)
+            return false;
+        void *mapped = MAP_FAILED;
+        if (::ftruncate(f, cap) == 0)
+            mapped =
+                ::mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+        if (mapped == MAP_FAILED) {
+            int error = errno;
+            ::close(f);
+            errno = error;
+            return false;
+        }
+
+        base = static_cast<char *>(mapped);
+        capacity = cap;
+        fd = f;
+        std::memcpy(base, &MAGIC, sizeof(MAGIC));
+        drops.store(0, std::memory_order_relaxed);
+        used.store(sizeof(MAGIC), std::memory_order_release);
+        return true;
+    }
+
+    void Recorder::close() {
+        if (!base)
+            return;
+        std::size_t length = size();
+        ::munmap(base, capacity);
+        if (::ftruncate(fd, length) != 0) {
+            // not fatal: the rest of the file's zeros, which Replay reads as
+            // the end of the log
+        }
+        ::close(fd);
+        base = nullptr;
+        capacity = 0;
+        fd = -1;
+        used.store(0, std::memory_order_relaxed);
+    }
+
+    void Recorder::write(uint32_t channel, const void *val, uint32_t size) {
+        std::size_t need = sizeof(Header) + ((size + 7) & ~std::size_t(7));
+        std::size_t at = used.fetch_add(need, std::memory_order_relaxed);
+        if (!base || at + need > capacity) {
+            // once one record doesn't fit, none of the later ones will, and
+            // the zeroed space it didn't use marks the end of the log
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Header h{channel, size,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count()};
+        std::memcpy(base + at + sizeof(Header), val, size);
+        std::memcpy(base + at, &h, sizeof(Header));
+    }
+
+    bool Replay::open(const char *path) {
+        close();
+        int f = ::open(path, O_RDONLY);
+        if (f < 0)
+            return false;
+        struct stat st {};
+        void *mapped = MAP_FAILED;
+        if (::fstat(f, &st) == 0 && st.st_size > 0)
+            mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, f, 0);
+        int error = errno;
+        ::close(f); // the mapping keeps the file open
+        if (mapped == MAP_FAILED) {
+            errno = st.st_size > 0 ? error : EINVAL;
+            return false;
+        }
+
+        base = static_cast<const char *>(mapped);
+        length = st.st_size;
+        uint64_t magic = 0;
+        if (length >= sizeof(magic))
+            std::memcpy(&magic, base, sizeof(magic));
+        if (magic != Recorder::MAGIC) {
+            close();
+            errno = EINVAL;
+            return false;
+        }
+        ::madvise(mapped, length, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    void Replay::close() {
+        if (!base)
+            return;
+        ::munmap(const_cast<char *>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+
+    std::size_t Replay::run(Graph &g, std::size_t batch) {
+        if (!base)
+            return 0;
+        if (batch == 0)
+            batch = 1;
+
+        std::size_t fed = 0, pending = 0, at = sizeof(Recorder::MAGIC);
+        Batch b = g.batch();
+        while (at + sizeof(Recorder::Header) <= length) {
+            Recorder::Header h;
+            std::memcpy(&h, base + at, sizeof(h));
+            const char *data = base + at + sizeof(h);
+            at += sizeof(h) + ((h.size + 7) & ~std::size_t(7));
+            if (h.size == 0 || at > length)
+                break; // the end of the log
+
+            if (h.channel >= feeds.size() || !feeds[h.channel].fn ||
+                feeds[h.channel].size != h.size)
+                continue;
+            feeds[h.channel].fn(b, data);
+            last_nanos = h.nanos;
+            fed++;
+
+            if (++pending == batch) {
+                b.commit();
+                while (g()) {
+                }
+                pending = 0;
+            }
+        }
+        b.commit();
+        while (g()) {
+        }
+        return fed;
+    }
+
+    bool Checkpoint::save(const char *path) const {
+        std::string out(reinterpret_cast<const char *>(&MAGIC), sizeof(MAGIC));
+        std::string state;
+        for (auto &entry : entries) {
+            state.clear();
+            entry.save(state);
+            uint32_t len = static_cast<uint32_t>(entry.key.size());
+            out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+            out.append(entry.key);
+            len = static_cast<uint32_t>(state.size());
+            out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+            out.append(state);
+        }
+
+        std::string tmp = std::string(path) + ".tmp";
+        int f = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (f < 0)
+            return false;
+        const char *p = out.data();
+        std::size_t left = out.size();
+        while (left) {
+            ssize_t written = ::write(f, p, left);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                int error = errno;
+                ::close(f);
+                ::unlink(tmp.c_str());
+                errno = error;
+                return false;
+            }
+            p += written;
+            left -= written;
+        }
+
+        // make sure the data's on disk before the rename makes it visible...
+        if (::fsync(f) != 0) {
+            int error = errno;
+            ::close(f);
+            ::unlink(tmp.c_str());
+            errno = error;
+            return false;
+        }
+        if (::close(f) != 0 || ::rename(tmp.c_str(), path) != 0) {
+            int error = errno;
+            ::unlink(tmp.c_str());
+            errno = error;
+            return false;
+        }
+
+        // ...and then that the rename itself is
+        std::string dir(path);
+        std::size_t slash = dir.rfind('/');
+        dir = slash == std::string::npos ? "." : dir.substr(0, slash + 1);
+        int d = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (d < 0)
+            return false;
+        bool synced = ::fsync(d) == 0;
+        int error = errno;
+        ::close(d);
+        errno = error;
+        return synced;
+    }
+
+    std::size_t Checkpoint::restore(const char *path) {
+        int f = ::open(path, O_RDONLY);
+        if (f < 0)
+            return 0;
+        struct stat st {};
+        void *mapped = MAP_FAILED;
+        if (::fstat(f, &st) == 0 &&
+            st.st_size >= static_cast<off_t>(sizeof(MAGIC)))
+            mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, f, 0);
+        ::close(f);
+        if (mapped == MAP_FAILED)
+            return 0;
+
+        const char *first = static_cast<const char *>(mapped);
+        const char *last = first + st.st_size;
+        uint64_t magic;
+        std::memcpy(&magic, first, sizeof(magic));
+        first += sizeof(magic);
+
+        std::unordered_map<std::string, Entry *> tracked;
+        for (auto &entry : entries) {
+            tracked.emplace(entry.key, &entry);
+        }
+
+        std::size_t restored = 0;
+        while (magic == MAGIC) {
+            // a length-prefixed key, then a length-prefixed state
+            uint32_t len;
+            if (last - first < static_cast<std::ptrdiff_t>(sizeof(len)))
+                break;
+            std::memcpy(&len, first, sizeof(len));
+            first += sizeof(len);
+            if (last - first < static_cast<std::ptrdiff_t>(len + sizeof(len)))
+                break;
+            std::string key(first, len);
+            first += len;
+            std::memcpy(&len, first, sizeof(len));
+            first += sizeof(len);
+            if (last - first < static_cast<std::ptrdiff_t>(len))
+                break;
+            const char *state = first;
+            first += len;
+
+            auto found = tracked.find(key);
+            if (found == tracked.end())
+                continue;
+            if (found->second->restore(state, state + len)) {
+                // it's already seen these values, so doesn't need evaluating
+                found->second->node->clean();
+                restored++;
+            }
+        }
+
+        ::munmap(mapped, st.st_size);
+        return restored;
+    }
+#endif
 }
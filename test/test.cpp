@@ -1,7 +1,10 @@
 #include <cppunit/ui/text/TestRunner.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <chrono>
+#include <sched.h>
+#include <stdlib.h>
 #include <thread>
+#include <unistd.h>
 
 #include "calcgraph.h"
 
@@ -57,6 +60,11 @@ class GraphTest final : public CppUnit::TestFixture {
         CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
         CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 1);
         CPPUNIT_ASSERT(res.read() == 5);
+
+        // null stats are still accepted
+        node->input<0>().append(g, 4);
+        CPPUNIT_ASSERT(g(nullptr));
+        CPPUNIT_ASSERT(res.read() == 6);
     }
 
     /**
@@ -266,6 +274,72 @@ class GraphTest final : public CppUnit::TestFixture {
         CPPUNIT_ASSERT(weak_res.read() == 1); // afterweak not calculated
     }
 
+    /**
+     * @brief A Node that's on the work queue and the heap should only be
+     * evaluated once
+     */
+    void testRedundant() {
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup: "in" can also append to "out" directly while it's being
+        // evaluated, as well as passing its output to "out" normally
+        std::function<void(int)> hook = [](int) {};
+        auto in = g.node().connect(
+            [&hook](int a) {
+                hook(a);
+                return a;
+            },
+            calcgraph::unconnected<int>());
+        auto out = g.node().connect(int_identity, in.get());
+        out->connect(res);
+        g(&stats);
+
+        hook = [&g, &out](int a) { out->input<0>().append(g, a); };
+        in->input<0>().append(g, 3);
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 2);
+        CPPUNIT_ASSERT(res.read() == 3);
+
+        // "out" is still on the work queue, but has already been evaluated
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 0);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.redundant == 1);
+        CPPUNIT_ASSERT(res.read() == 3);
+    }
+
+    void testFullStats() {
+        struct calcgraph::FullStats stats;
+        calcgraph::Graph g;
+
+        // setup
+        auto one =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto two = g.node().connect(int_identity, one.get());
+        auto three = g.node().connect(int_identity, two.get());
+        auto four = g.node().connect(int_identity, two.get());
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.totals.queued == 4);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.drained[3] == 1);
+
+        one->input<0>().append(g, 1);
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.totals.queued == 1);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.totals.worked == 4);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.drained[1] == 1);
+
+        // three and four are on the heap together after two is eval()'ed
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.heap_depth[0] == 3);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.heap_depth[1] == 1);
+
+        CPPUNIT_ASSERT(calcgraph::FullStats::bucket(0) == 0);
+        CPPUNIT_ASSERT(calcgraph::FullStats::bucket(4) == 3);
+        CPPUNIT_ASSERT(calcgraph::FullStats::bucket(UINT64_MAX) == 31);
+    }
+
     void testSharedPointer() {
         struct calcgraph::Stats stats;
         calcgraph::Graph g;
@@ -300,6 +374,753 @@ class GraphTest final : public CppUnit::TestFixture {
         CPPUNIT_ASSERT(res.read() == 2);
     }
 
+    void testFanOut() {
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+
+        // setup: dependents both before and after the head
+        std::vector<calcgraph::Latest<int>> res(20);
+        std::vector<boost::intrusive_ptr<calcgraph::Work>> keep;
+        std::vector<calcgraph::Input<int>> earlier;
+        for (std::size_t i = 0; i < 10; ++i) {
+            auto n =
+                g.node().connect(int_identity, calcgraph::unconnected<int>());
+            n->connect(res[i]);
+            earlier.push_back(n->input<0>());
+            keep.push_back(n);
+        }
+        auto head =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        for (auto &in : earlier) {
+            head->connect(in);
+        }
+        for (std::size_t i = 10; i < res.size(); ++i) {
+            auto n = g.node().connect(int_identity, head.get());
+            n->connect(res[i]);
+            keep.push_back(n);
+        }
+        g();
+        g(); // the earlier ones, scheduled by the head's first evaluation
+
+        head->input<0>().append(g, 5);
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.pushed_heap == 10);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.pushed_graph == 10);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 11);
+        for (std::size_t i = 10; i < res.size(); ++i) {
+            CPPUNIT_ASSERT(res[i].read() == 5);
+        }
+        CPPUNIT_ASSERT(res[0].read() == 0);
+
+        // the earlier ones were spliced onto the work_queue together
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 10);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 10);
+        for (std::size_t i = 0; i < 10; ++i) {
+            CPPUNIT_ASSERT(res[i].read() == 5);
+        }
+    }
+
+    void testPriority() {
+        calcgraph::Graph g;
+        std::vector<int> order;
+        auto record = [&order](int a) {
+            order.push_back(a);
+            return a;
+        };
+
+        // setup: the low-priority Node is built first, so has a lower id
+        auto low = g.node()
+                       .priority(calcgraph::Priority::LOW)
+                       .connect(record, calcgraph::unconnected<int>());
+        auto low_dependent = g.node()
+                                 .priority(calcgraph::Priority::LOW)
+                                 .connect(record, low.get());
+        auto high = g.node()
+                        .priority(calcgraph::Priority::HIGH)
+                        .connect(record, calcgraph::unconnected<int>());
+        auto high_dependent = g.node()
+                                  .priority(calcgraph::Priority::HIGH)
+                                  .connect(record, high.get());
+        CPPUNIT_ASSERT(high->priority() == calcgraph::Priority::HIGH);
+        g();
+        order.clear();
+
+        // the higher lane's drained first, in topological order
+        low->input<0>().append(g, 1);
+        high->input<0>().append(g, 2);
+        g();
+        CPPUNIT_ASSERT(order == std::vector<int>({2, 2, 1, 1}));
+        order.clear();
+
+        // the low lane's clock starts when it's reached, and it gets to
+        // evaluate one Node before its budget's used up
+        g.budget(calcgraph::Priority::LOW, std::chrono::nanoseconds(1));
+        low->input<0>().append(g, 3);
+        high->input<0>().append(g, 4);
+        calcgraph::Stats stats;
+        g(&stats);
+        CPPUNIT_ASSERT(order == std::vector<int>({4, 4, 3}));
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.deferred == 1);
+
+        // ...so the deferred dependent's evaluated next time, even though
+        // the budget's still tiny
+        g(&stats);
+        CPPUNIT_ASSERT(order == std::vector<int>({4, 4, 3, 3}));
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.deferred == 0);
+        g.budget(calcgraph::Priority::LOW, std::chrono::nanoseconds::zero());
+    }
+
+    void testCompact() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup: the dependent's built before its dependency
+        auto sink =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto source =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        source->connect(sink->input<0>());
+        sink->connect(res);
+        uint32_t sink_id = sink->id, source_id = source->id;
+        while (g()) {
+        }
+
+        // so a change takes two evaluations to get through
+        source->input<0>().append(g, 1);
+        g();
+        CPPUNIT_ASSERT(res.read() == 0);
+        g();
+        CPPUNIT_ASSERT(res.read() == 1);
+
+        // renumbering gives them fresh ids in topological order...
+        CPPUNIT_ASSERT(g.compact({source.get()}));
+        CPPUNIT_ASSERT(source->id > std::max(sink_id, source_id));
+        CPPUNIT_ASSERT(sink->id > source->id);
+
+        // ...so it only takes one
+        source->input<0>().append(g, 2);
+        g();
+        CPPUNIT_ASSERT(res.read() == 2);
+
+        // a cycle has no topological order
+        uint32_t compacted_id = source->id;
+        sink->connect(source->input<0>());
+        CPPUNIT_ASSERT(!g.compact({source.get()}));
+        CPPUNIT_ASSERT(source->id == compacted_id);
+        sink->disconnect(source->input<0>());
+    }
+
+    void testCompactUnreachedUpstream() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup: root -> middle -> leaf, with the middle Node built last and
+        // another (unreached) source feeding into it
+        auto root =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto leaf =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto other =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto middle =
+            g.node().connect(std::plus<int>(), calcgraph::unconnected<int>(),
+                             calcgraph::unconnected<int>());
+        root->connect(middle->input<0>());
+        other->connect(middle->input<1>());
+        middle->connect(leaf->input<0>());
+        leaf->connect(res);
+        while (g()) {
+        }
+
+        // the renumbered Nodes all come after the one that wasn't reached...
+        CPPUNIT_ASSERT(g.compact({root.get()}));
+        CPPUNIT_ASSERT(root->id < middle->id);
+        CPPUNIT_ASSERT(middle->id < leaf->id);
+        CPPUNIT_ASSERT(other->id < middle->id);
+
+        // ...so a change to it still only takes one evaluation
+        other->input<0>().append(g, 3);
+        g();
+        CPPUNIT_ASSERT(res.read() == 3);
+    }
+
+    void testCompactWeakCycle() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup: a running total fed back into itself through a Weak Node,
+        // with its dependent built first
+        auto sink =
+            g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto total =
+            g.node().connect(std::plus<int>(), calcgraph::unconnected<int>(),
+                             calcgraph::unconnected<int>());
+        auto feedback = g.node().propagate<calcgraph::Weak>().connect(
+            int_identity, total.get());
+        feedback->connect(total->input<1>());
+        total->connect(sink->input<0>());
+        sink->connect(res);
+        while (g()) {
+        }
+
+        // the Weak connection isn't a cycle...
+        CPPUNIT_ASSERT(g.compact({total.get()}));
+        CPPUNIT_ASSERT(total->id < sink->id);
+        CPPUNIT_ASSERT(total->id < feedback->id);
+
+        // ...and the total still accumulates
+        total->input<0>().append(g, 2);
+        g();
+        CPPUNIT_ASSERT(res.read() == 2);
+        total->input<0>().append(g, 3);
+        g();
+        CPPUNIT_ASSERT(res.read() == 5);
+    }
+
+    void testPipe() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+        int calls = 0;
+
+        // setup: sum, then bucket, then an expensive last stage
+        auto node = g.node()
+                        .pipe([](int a, int b) { return a + b; })
+                        .pipe([](int sum) { return sum / 10; })
+                        .pipe([&calls](int bucket) {
+                            calls++;
+                            return bucket * 2;
+                        })
+                        .connect(calcgraph::unconnected<int>(),
+                                 calcgraph::unconnected<int>());
+        node->connect(res);
+        g();
+        CPPUNIT_ASSERT(calls == 1);
+        CPPUNIT_ASSERT(res.read() == 0);
+
+        node->input<0>().append(g, 11);
+        g();
+        CPPUNIT_ASSERT(calls == 2);
+        CPPUNIT_ASSERT(res.read() == 2);
+
+        // same bucket, so the last stage isn't called
+        node->input<1>().append(g, 3);
+        g();
+        CPPUNIT_ASSERT(calls == 2);
+        CPPUNIT_ASSERT(res.read() == 2);
+
+        node->input<1>().append(g, 9);
+        g();
+        CPPUNIT_ASSERT(calls == 3);
+        CPPUNIT_ASSERT(res.read() == 4);
+    }
+
+    void testReductions() {
+        for (int n = 0; n < 40; ++n) {
+            std::vector<double> vals, ones(n, 1.0);
+            double total = 0, lowest = 1e9, highest = -1e9;
+            for (int i = 0; i < n; ++i) {
+                double v = (i * 7) % 11 - 5;
+                vals.push_back(v);
+                total += v;
+                lowest = std::min(lowest, v);
+                highest = std::max(highest, v);
+            }
+            CPPUNIT_ASSERT(calcgraph::reduce::sum(vals) == total);
+            CPPUNIT_ASSERT(calcgraph::reduce::dot(vals, ones) == total);
+            if (n > 0) {
+                CPPUNIT_ASSERT(calcgraph::reduce::min(vals) == lowest);
+                CPPUNIT_ASSERT(calcgraph::reduce::max(vals) == highest);
+            }
+        }
+        std::vector<int> none;
+        CPPUNIT_ASSERT(calcgraph::reduce::min(none) ==
+                       std::numeric_limits<int>::max());
+    }
+
+    void testOnChangeVector() {
+        calcgraph::Graph g;
+        int calls = 0;
+        using doubles = std::shared_ptr<std::vector<double>>;
+
+        // setup: a Node that makes a new (but maybe equal) vector each time
+        auto source =
+            g.node()
+                .propagate<calcgraph::OnChange>()
+                .connect(
+                    [](int a) {
+                        return std::make_shared<std::vector<double>>(
+                            3, static_cast<double>(a / 10));
+                    },
+                    calcgraph::unconnected<int>());
+        auto sink = g.node().connect(
+            [&calls](doubles d) {
+                calls++;
+                return d;
+            },
+            source.get());
+        g();
+        g();
+        CPPUNIT_ASSERT(calls == 1);
+
+        source->input<0>().append(g, 5);
+        g();
+        CPPUNIT_ASSERT(calls == 1);
+
+        source->input<0>().append(g, 15);
+        g();
+        CPPUNIT_ASSERT(calls == 2);
+
+        // NaNs compare bitwise, so an identical one isn't a change
+        std::vector<double> nans(1, std::numeric_limits<double>::quiet_NaN());
+        CPPUNIT_ASSERT(!calcgraph::differs(nans, nans));
+        std::vector<double> one(1, 1.0), two(2, 1.0);
+        CPPUNIT_ASSERT(calcgraph::differs(one, two));
+
+        // bit-packed vectors use operator!= instead
+        std::vector<bool> flags(3, false), set(3, false);
+        set[1] = true;
+        CPPUNIT_ASSERT(!calcgraph::differs(flags, flags));
+        CPPUNIT_ASSERT(calcgraph::differs(flags, set));
+
+        // as do vectors of padded values, so only the value bits count
+        std::vector<long double> zero(2, 0.0L), negative(2, -0.0L),
+            other(2, 1.0L);
+        CPPUNIT_ASSERT(!calcgraph::differs(zero, negative));
+        CPPUNIT_ASSERT(calcgraph::differs(zero, other));
+    }
+
+#ifdef __linux__
+    void testRecordReplay() {
+        char path[] = "/tmp/calcgraph-test-XXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+
+        // setup: record everything appended to a Node
+        std::vector<int> seen;
+        calcgraph::Graph g;
+        auto node = g.node().connect(
+            [&seen](int a) {
+                seen.push_back(a);
+                return a;
+            },
+            calcgraph::unconnected<int>());
+        g();
+        calcgraph::Recorder rec;
+        CPPUNIT_ASSERT(rec.open(path, 4096));
+        auto in = rec.record(0, node->input<0>());
+        for (int i = 1; i <= 10; ++i) {
+            in.append(g, i);
+            g();
+        }
+        CPPUNIT_ASSERT(seen.size() == 11);
+        CPPUNIT_ASSERT(rec.dropped() == 0);
+        rec.close();
+
+        // feed them into another Graph, one at a time
+        std::vector<int> replayed;
+        calcgraph::Graph g2;
+        auto node2 = g2.node().connect(
+            [&replayed](int a) {
+                replayed.push_back(a);
+                return a;
+            },
+            calcgraph::unconnected<int>());
+        g2();
+        replayed.clear();
+        calcgraph::Replay replay;
+        CPPUNIT_ASSERT(replay.open(path));
+        replay.replay(0, node2->input<0>());
+        CPPUNIT_ASSERT(replay.run(g2, 1) == 10);
+        seen.erase(seen.begin());
+        CPPUNIT_ASSERT(replayed == seen);
+        CPPUNIT_ASSERT(replay.nanos() > 0);
+        replay.close();
+
+        // only room for one record
+        CPPUNIT_ASSERT(rec.open(path, 32));
+        in.append(g, 11);
+        in.append(g, 12);
+        g();
+        CPPUNIT_ASSERT(rec.dropped() == 1);
+        CPPUNIT_ASSERT(seen.back() == 12);
+        rec.close();
+        CPPUNIT_ASSERT(replay.open(path));
+        CPPUNIT_ASSERT(replay.run(g2) == 1);
+        CPPUNIT_ASSERT(replayed.back() == 11);
+        replay.close();
+
+        unlink(path);
+    }
+
+    void testCheckpoint() {
+        char path[] = "/tmp/calcgraph-test-XXXXXX";
+        int fd = mkstemp(path);
+        CPPUNIT_ASSERT(fd >= 0);
+        close(fd);
+
+        int sum_calls = 0, sink_calls = 0, var_calls = 0;
+        auto add = [&sum_calls](int a, int b) {
+            sum_calls++;
+            return a + b;
+        };
+        auto identity = [&sink_calls](int a) {
+            sink_calls++;
+            return a;
+        };
+        auto total = [&var_calls](std::shared_ptr<std::vector<double>> v) {
+            var_calls++;
+            return calcgraph::reduce::sum(*v);
+        };
+
+        // setup: build a Graph, give it some state and save it
+        {
+            calcgraph::Graph g;
+            auto sum = g.node().propagate<calcgraph::OnChange>().connect(
+                add, calcgraph::unconnected<int>(),
+                calcgraph::unconnected<int>());
+            auto sink = g.node().connect(identity, sum.get());
+            auto var = g.node().variadic<double>().connect(total);
+            auto first = var->variadic_add<0>();
+            auto second = var->variadic_add<0>();
+            sum->input<0>().append(g, 2);
+            sum->input<1>().append(g, 3);
+            first.append(g, 1.5);
+            second.append(g, 2.5);
+            while (g()) {
+            }
+
+            calcgraph::Checkpoint checkpoint;
+            checkpoint.track("sum", sum);
+            checkpoint.track("sink", sink);
+            checkpoint.track("var", var);
+            CPPUNIT_ASSERT(checkpoint.save(path));
+        }
+
+        // rebuild it, and restore the state before the first evaluation
+        sum_calls = sink_calls = var_calls = 0;
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+        calcgraph::Latest<double> var_res;
+        auto sum = g.node().propagate<calcgraph::OnChange>().connect(
+            add, calcgraph::unconnected<int>(), calcgraph::unconnected<int>());
+        auto sink = g.node().connect(identity, sum.get());
+        sink->connect(res);
+        auto var = g.node().variadic<double>().connect(total);
+        var->connect(var_res);
+        auto first = var->variadic_add<0>();
+        auto second = var->variadic_add<0>();
+        calcgraph::Checkpoint checkpoint;
+        checkpoint.track("sum", sum);
+        checkpoint.track("sink", sink);
+        checkpoint.track("var", var);
+        checkpoint.track("missing", sink);
+        CPPUNIT_ASSERT(checkpoint.restore(path) == 3);
+
+        // no thundering herd
+        while (g()) {
+        }
+        CPPUNIT_ASSERT(sum_calls == 0);
+        CPPUNIT_ASSERT(sink_calls == 0);
+        CPPUNIT_ASSERT(var_calls == 0);
+
+        // ...so nothing's passed on to dependents that aren't tracked
+        CPPUNIT_ASSERT(var_res.read() == 0.0);
+
+        // OnChange remembers the last sum, so the same one isn't passed on
+        sum->input<1>().append(g, 3);
+        g();
+        CPPUNIT_ASSERT(sum_calls == 1);
+        CPPUNIT_ASSERT(sink_calls == 0);
+
+        // ...and the other input kept its value
+        sum->input<0>().append(g, 4);
+        g();
+        CPPUNIT_ASSERT(sink_calls == 1);
+        CPPUNIT_ASSERT(res.read() == 7);
+
+        second.append(g, 3.5);
+        g();
+        CPPUNIT_ASSERT(var_res.read() == 5.0);
+
+        // a Node whose second input's changed type isn't restored at all,
+        // not even its first input
+        calcgraph::Latest<double> changed_res;
+        auto changed =
+            g.node().connect([](int a, double b) { return a + b; },
+                             calcgraph::unconnected<int>(),
+                             calcgraph::unconnected<double>());
+        changed->connect(changed_res);
+        calcgraph::Checkpoint changed_checkpoint;
+        changed_checkpoint.track("sum", changed);
+        CPPUNIT_ASSERT(changed_checkpoint.restore(path) == 0);
+        changed->input<1>().append(g, 1.0);
+        g();
+        CPPUNIT_ASSERT(changed_res.read() == 1.0);
+
+        // nor is one with a different number of variadic inputs
+        auto wider = g.node().variadic<double>().connect(total);
+        auto wider_first = wider->variadic_add<0>();
+        wider->variadic_add<0>();
+        wider->variadic_add<0>();
+        calcgraph::Checkpoint wider_checkpoint;
+        wider_checkpoint.track("var", wider);
+        CPPUNIT_ASSERT(wider_checkpoint.restore(path) == 0);
+        var_calls = 0;
+        wider_first.append(g, 1.0);
+        g();
+        CPPUNIT_ASSERT(var_calls == 1);
+
+        // pointers are never saved, as they'd dangle after a restart
+        static_assert(calcgraph::checkpointable<double>::value, "saved");
+        static_assert(!calcgraph::checkpointable<int *>::value, "saved");
+        auto pointed =
+            g.node().connect([](const int *p) { return p != nullptr; },
+                             calcgraph::unconnected<const int *>());
+        auto valued = g.node().connect([](int a) { return a != 0; },
+                                       calcgraph::unconnected<int>());
+        std::string pointed_state, valued_state;
+        pointed->save_state(pointed_state);
+        valued->save_state(valued_state);
+        CPPUNIT_ASSERT(pointed_state.size() + sizeof(int) ==
+                       valued_state.size());
+
+        unlink(path);
+        CPPUNIT_ASSERT(checkpoint.restore(path) == 0);
+    }
+#endif
+
+    void testThrottle() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+        int calls = 0;
+
+        // setup: at most one value per 100ms
+        auto throttled = g.node()
+                             .propagate<calcgraph::Throttle<100000>::type>()
+                             .connect(int_identity,
+                                      calcgraph::unconnected<int>());
+        auto sink = g.node().connect(
+            [&calls](int a) {
+                calls++;
+                return a;
+            },
+            throttled.get());
+        sink->connect(res);
+        g();
+        g();
+        CPPUNIT_ASSERT(calls == 1);
+
+        // values in the same window are held back
+        throttled->input<0>().append(g, 1);
+        g();
+        throttled->input<0>().append(g, 2);
+        g();
+        CPPUNIT_ASSERT(calls == 1);
+        CPPUNIT_ASSERT(res.read() == 0);
+
+        // ...until the window closes, when the latest one is passed on
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        g();
+        g();
+        CPPUNIT_ASSERT(calls == 2);
+        CPPUNIT_ASSERT(res.read() == 2);
+
+        // nothing left to flush
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        CPPUNIT_ASSERT(!g());
+    }
+
+    void testTolerance() {
+        calcgraph::Graph g;
+        calcgraph::Latest<double> res;
+        auto node =
+            g.node()
+                .propagate<calcgraph::Tolerance<std::ratio<1, 10>>::type>()
+                .connect([](double a) { return a; },
+                         calcgraph::unconnected<double>());
+        node->connect(res);
+        g();
+
+        node->input<0>().append(g, 0.05);
+        g();
+        CPPUNIT_ASSERT(res.read() == 0.0);
+
+        // moved far enough from the last value passed on
+        node->input<0>().append(g, 0.12);
+        g();
+        CPPUNIT_ASSERT(res.read() == 0.12);
+
+        node->input<0>().append(g, 0.15);
+        g();
+        CPPUNIT_ASSERT(res.read() == 0.12);
+
+        // integral values far enough apart to overflow a signed difference
+        calcgraph::Latest<int> ints;
+        auto wide = g.node()
+                        .propagate<calcgraph::Tolerance<std::ratio<2>>::type>()
+                        .connect([](int a) { return a; },
+                                 calcgraph::unconnected<int>());
+        wide->connect(ints);
+        g();
+        wide->input<0>().append(g, std::numeric_limits<int>::max());
+        g();
+        CPPUNIT_ASSERT(ints.read() == std::numeric_limits<int>::max());
+        wide->input<0>().append(g, std::numeric_limits<int>::min());
+        g();
+        CPPUNIT_ASSERT(ints.read() == std::numeric_limits<int>::min());
+        wide->input<0>().append(g, std::numeric_limits<int>::min() + 2);
+        g();
+        CPPUNIT_ASSERT(ints.read() == std::numeric_limits<int>::min());
+        wide->input<0>().append(g, std::numeric_limits<int>::min() + 3);
+        g();
+        CPPUNIT_ASSERT(ints.read() == std::numeric_limits<int>::min() + 3);
+
+        // unsigned values are fine too
+        calcgraph::Latest<unsigned> sizes;
+        auto counts =
+            g.node()
+                .propagate<calcgraph::Tolerance<std::ratio<1>>::type>()
+                .connect([](unsigned a) { return a; },
+                         calcgraph::unconnected<unsigned>());
+        counts->connect(sizes);
+        g();
+        counts->input<0>().append(g, 5u);
+        g();
+        CPPUNIT_ASSERT(sizes.read() == 5u);
+        counts->input<0>().append(g, 4u);
+        g();
+        CPPUNIT_ASSERT(sizes.read() == 5u);
+        counts->input<0>().append(g, 3u);
+        g();
+        CPPUNIT_ASSERT(sizes.read() == 3u);
+    }
+
+    void testLazy() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+        int calls = 0;
+
+        // setup: two Lazy Nodes in a row, feeding an eager one
+        auto expensive = g.node()
+                             .propagate<calcgraph::Lazy>()
+                             .connect(
+                                 [&calls](int a) {
+                                     calls++;
+                                     return a * 2;
+                                 },
+                                 calcgraph::unconnected<int>());
+        auto derived = g.node()
+                           .propagate<calcgraph::Lazy>()
+                           .connect([](int a) { return a + 1; },
+                                    expensive.get());
+        auto sink = g.node().connect(int_identity, derived.get());
+        sink->connect(res);
+        g();
+        CPPUNIT_ASSERT(calls == 0);
+
+        // changes just invalidate
+        expensive->input<0>().append(g, 1);
+        g();
+        expensive->input<0>().append(g, 2);
+        g();
+        CPPUNIT_ASSERT(calls == 0);
+
+        // get() calculates on demand, and caches
+        CPPUNIT_ASSERT(expensive->get(g) == 4);
+        CPPUNIT_ASSERT(expensive->get(g) == 4);
+        CPPUNIT_ASSERT(calls == 1);
+
+        // pull() brings the whole chain up to date
+        expensive->input<0>().append(g, 3);
+        g.pull();
+        CPPUNIT_ASSERT(calls == 2);
+        CPPUNIT_ASSERT(derived->get(g) == 7);
+        CPPUNIT_ASSERT(res.read() == 7);
+
+        // nothing to do
+        g.pull();
+        CPPUNIT_ASSERT(calls == 2);
+    }
+
+    void testBatch() {
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+        calcgraph::Latest<intvector> res;
+
+        // append_many only schedules once
+        auto batched = g.node()
+                           .batched(calcgraph::unconnected<int>())
+                           .connect([](auto v) {
+                               return intvector(new std::vector<int>(*v));
+                           });
+        batched->connect(res);
+        g();
+        std::vector<int> values({1, 2, 3});
+        batched->input<0>().append_many(g, values.begin(), values.end());
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
+        CPPUNIT_ASSERT(*res.read() == values);
+
+        // a Batch schedules everything at once, when it's committed
+        auto sum = g.node().connect(std::plus<int>(),
+                                    calcgraph::unconnected<int>(),
+                                    calcgraph::unconnected<int>());
+        calcgraph::Latest<int> total;
+        sum->connect(total);
+        g();
+        {
+            auto batch = g.batch();
+            batch.append(sum->input<0>(), 4);
+            batch.append(sum->input<1>(), 5);
+            batch.append_many(batched->input<0>(), values.begin(),
+                              values.end());
+            CPPUNIT_ASSERT(!g());
+        }
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 2);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 2);
+        CPPUNIT_ASSERT(total.read() == 9);
+        CPPUNIT_ASSERT(*res.read() == values);
+
+        // Nodes already on the work_queue aren't added again
+        auto batch = g.batch();
+        sum->input<0>().append(g, 1);
+        batch.append(sum->input<1>(), 2);
+        batch.commit();
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
+
+        // many threads committing batches while another evaluates
+        std::atomic<bool> stop(false);
+        std::atomic<int> seen(0);
+        auto counter = g.node().batched(calcgraph::unconnected<int>()).connect(
+            [&seen](std::shared_ptr<const std::vector<int>> v) {
+                seen.fetch_add(v->size());
+                return 0;
+            });
+        std::thread evaluator(calcgraph::evaluate_repeatedly, std::ref(g),
+                              std::ref(stop));
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 4; ++t) {
+            producers.emplace_back([&g, &counter, &values]() {
+                for (int i = 0; i < 1000; ++i) {
+                    auto batch = g.batch();
+                    batch.append_many(counter->input<0>(), values.begin(),
+                                      values.end());
+                }
+            });
+        }
+        for (auto &p : producers)
+            p.join();
+        while (seen.load() < 4 * 1000 * 3)
+            std::this_thread::yield();
+        stop.store(true);
+        evaluator.join();
+        CPPUNIT_ASSERT(seen.load() == 4 * 1000 * 3);
+    }
+
     void testThreaded() {
         calcgraph::Graph g;
         std::atomic<bool> stop(false);
@@ -334,6 +1155,237 @@ class GraphTest final : public CppUnit::TestFixture {
         t.join();
     }
 
+    void testParking() {
+        calcgraph::Graph g;
+        std::atomic<bool> stop(false);
+        calcgraph::Latest<int> res;
+
+        // start the evaluation thread, which will park almost straight away
+        // and (if not woken up) sleep for much longer than this test takes
+        std::thread t(calcgraph::evaluate_or_park, std::ref(g), std::ref(stop),
+                      10, std::chrono::milliseconds(60000));
+
+        auto node =
+            g.node().connect(std::plus<int>(), calcgraph::unconnected<int>(),
+                             calcgraph::unconnected<int>());
+        node->connect(res);
+        node->input<0>().append(g, 1);
+        node->input<1>().append(g, 2);
+
+        // ... wait for calculation
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT(res.read() == 3);
+
+        // now the thread is definitely parked, so this should wake it
+        node->input<0>().append(g, 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT(res.read() == 5);
+
+        // terminate the evaluation thread, waking it up so it sees the flag
+        stop.store(true, std::memory_order_seq_cst);
+        node->input<0>().append(g, 4);
+        t.join();
+    }
+
+    void testParallel() {
+        calcgraph::Graph g;
+        std::atomic<bool> stop(false);
+        std::vector<calcgraph::Latest<int>> res(50);
+
+        // start the evaluation threads
+        std::thread t(calcgraph::evaluate_in_parallel, std::ref(g),
+                      std::ref(stop), 4u);
+
+        // setup: lots of independent pipelines
+        std::vector<boost::intrusive_ptr<calcgraph::Work>> keep;
+        std::vector<calcgraph::Input<int>> ins;
+        for (auto &r : res) {
+            auto in =
+                g.node().connect(int_identity, calcgraph::unconnected<int>());
+            auto out = g.node().connect(std::plus<int>(), in.get(), in.get());
+            out->connect(r);
+            ins.push_back(in->input<0>());
+            keep.push_back(in);
+            keep.push_back(out);
+        }
+
+        for (std::size_t i = 0; i < ins.size(); ++i) {
+            ins[i].append(g, i);
+        }
+
+        // ... wait for calculation
+        std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (std::size_t i = 0; i < res.size(); ++i) {
+            CPPUNIT_ASSERT(res[i].read() == static_cast<int>(2 * i));
+        }
+
+        ins[7].append(g, 10);
+
+        // ... wait for calculation
+        std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT(res[7].read() == 20);
+
+        // terminate the evaluation threads
+        stop.store(true, std::memory_order_seq_cst);
+        t.join();
+    }
+
+    void testParallelDiamond() {
+        calcgraph::Graph g;
+        std::atomic<bool> stop(false);
+        std::atomic<int> torn(0);
+        std::vector<calcgraph::Latest<int>> res(256);
+
+        // setup: independent diamonds, whose bottom Node checks it never sees
+        // one side updated without the other. Each layer's built in turn, so
+        // the diamonds' ids interleave.
+        auto check = [&torn](int left, int right) {
+            if (right != 2 * (left - 1))
+                torn++;
+            return right;
+        };
+        auto increment = [](int a) { return a + 1; };
+        auto twice = [](int a) { return a * 2; };
+        std::vector<boost::intrusive_ptr<calcgraph::Work>> keep;
+        std::vector<calcgraph::Input<int>> ins;
+        std::vector<calcgraph::Connectable<int> *> tops, lefts, rights;
+        for (std::size_t i = 0; i < res.size(); ++i) {
+            auto top =
+                g.node().connect(int_identity, calcgraph::unconnected<int>());
+            ins.push_back(top->input<0>());
+            tops.push_back(top.get());
+            keep.push_back(top);
+        }
+        for (auto top : tops) {
+            auto left = g.node().connect(increment, top);
+            lefts.push_back(left.get());
+            keep.push_back(left);
+        }
+        for (auto top : tops) {
+            auto right = g.node().connect(twice, top);
+            rights.push_back(right.get());
+            keep.push_back(right);
+        }
+        for (std::size_t i = 0; i < res.size(); ++i) {
+            auto bottom = g.node().connect(check, lefts[i], rights[i]);
+            bottom->connect(res[i]);
+            keep.push_back(bottom);
+        }
+
+        std::thread t(calcgraph::evaluate_in_parallel, std::ref(g),
+                      std::ref(stop), 4u);
+        for (int v = 1; v <= 1000; ++v) {
+            for (auto &in : ins) {
+                in.append(g, v);
+            }
+        }
+
+        // ... wait for calculation
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stop.store(true);
+        t.join();
+        CPPUNIT_ASSERT(torn.load() == 0);
+        for (auto &r : res) {
+            CPPUNIT_ASSERT(r.read() == 2000);
+        }
+    }
+
+    void testPinned() {
+        calcgraph::Graph a, b;
+        std::atomic<bool> stop(false);
+        calcgraph::Latest<int> res;
+        std::atomic<int> cpu_a(-1);
+
+        // one Graph per core; we only know we're allowed to run on this one
+        std::vector<unsigned> cpus{static_cast<unsigned>(sched_getcpu())};
+        bool pinned = false;
+        std::thread([&cpus, &pinned]() {
+            pinned = calcgraph::pin_current_thread(cpus);
+        }).join();
+        CPPUNIT_ASSERT(pinned);
+
+        std::thread ta =
+            calcgraph::start_evaluating(a, stop, cpus, 256 * 1024);
+        std::thread tb = calcgraph::start_evaluating(b, stop, cpus);
+
+        // a pipeline on b, fed by a node on a appending to b's Input
+        auto sink = b.node().connect(int_identity,
+                                     calcgraph::unconnected<int>());
+        sink->connect(res);
+        auto sink_in = sink->input<0>();
+        auto source = a.node().connect(
+            [&b, &sink_in, &cpu_a](int v) {
+                cpu_a.store(sched_getcpu());
+                sink_in.append(b, v * 2);
+                return v;
+            },
+            calcgraph::unconnected<int>());
+
+        source->input<0>().append(a, 21);
+
+        // ... wait for calculation
+        std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT(res.read() == 42);
+        CPPUNIT_ASSERT(cpu_a.load() == static_cast<int>(cpus[0]));
+
+        // terminate the evaluation threads
+        stop.store(true, std::memory_order_seq_cst);
+        ta.join();
+        tb.join();
+    }
+
+    void testChannel() {
+        calcgraph::Graph a, b;
+        calcgraph::Latest<int> res;
+
+        // setup: a node on a passing values to a node on b
+        auto sink =
+            b.node().connect(int_identity, calcgraph::unconnected<int>());
+        sink->connect(res);
+        auto &channel = b.channel<int, 2>(sink->input<0>());
+        auto source =
+            a.node().connect(int_identity, calcgraph::unconnected<int>());
+        source->connect(channel);
+        a();
+        b();
+
+        source->input<0>().append(a, 1);
+        a();
+        CPPUNIT_ASSERT(res.read() == 0); // not drained yet
+        CPPUNIT_ASSERT(b());
+        CPPUNIT_ASSERT(res.read() == 1);
+        CPPUNIT_ASSERT(!b());
+
+        // fill the channel
+        CPPUNIT_ASSERT(channel.try_store(2));
+        CPPUNIT_ASSERT(channel.try_store(3));
+        CPPUNIT_ASSERT(!channel.try_store(4));
+        source->input<0>().append(a, 5);
+        a();
+        CPPUNIT_ASSERT(channel.dropped() == 2);
+        b();
+        CPPUNIT_ASSERT(res.read() == 3);
+
+        // a parked evaluation thread is woken by a store
+        std::atomic<bool> stop(false);
+        std::thread t(calcgraph::evaluate_or_park, std::ref(b), std::ref(stop),
+                      1u, std::chrono::milliseconds(10000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        channel.store(6);
+
+        // ... wait for calculation
+        std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CPPUNIT_ASSERT(res.read() == 6);
+
+        stop.store(true, std::memory_order_seq_cst);
+        channel.store(7); // so it wakes up and sees the stop flag
+        t.join();
+    }
+
     void testDisconnect() {
         struct calcgraph::Stats stats;
         calcgraph::Graph g;
@@ -400,6 +1452,91 @@ class GraphTest final : public CppUnit::TestFixture {
                                   res.read()->begin(), res.read()->end()));
     }
 
+    void testRing() {
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+        calcgraph::Latest<intvector> res;
+        auto tovector = [](calcgraph::View<int> vals) {
+            return intvector(new std::vector<int>(vals.begin(), vals.end()));
+        };
+
+        // drops the oldest values by default
+        auto ring = g.node()
+                        .ring<int, 4>(calcgraph::unconnected<int>())
+                        .connect(tovector);
+        ring->connect(res);
+        for (int i = 1; i <= 6; ++i)
+            ring->input<0>().append(g, i);
+
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.queued == 1);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 1);
+        auto expected = intvector(new std::vector<int>({3, 4, 5, 6}));
+        CPPUNIT_ASSERT(*res.read() == *expected);
+
+        ring->input<0>().append(g, 7);
+        g(&stats);
+        expected = intvector(new std::vector<int>({7}));
+        CPPUNIT_ASSERT(*res.read() == *expected);
+
+        // rejecting values when full
+        auto bounded =
+            g.node()
+                .ring<int, 2, calcgraph::Overflow::REJECT>(
+                    calcgraph::unconnected<int>())
+                .connect(tovector);
+        bounded->connect(res);
+        CPPUNIT_ASSERT(bounded->input<0>().try_append(g, 1));
+        CPPUNIT_ASSERT(bounded->input<0>().try_append(g, 2));
+        CPPUNIT_ASSERT(!bounded->input<0>().try_append(g, 3));
+        g(&stats);
+        expected = intvector(new std::vector<int>({1, 2}));
+        CPPUNIT_ASSERT(*res.read() == *expected);
+        CPPUNIT_ASSERT(bounded->input<0>().try_append(g, 3));
+    }
+
+    void testBatched() {
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup
+        auto batched = g.node()
+                           .batched(calcgraph::unconnected<int>())
+                           .connect([](auto vals) {
+                               int sum = 0;
+                               for (int v : *vals)
+                                   sum = sum * 10 + v;
+                               return sum;
+                           });
+        batched->connect(res);
+        batched->input<0>().append(g, 3);
+        batched->input<0>().append(g, 4);
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 1);
+        CPPUNIT_ASSERT(res.read() == 34);
+
+        // the batch vector is recycled, and nothing's allocated when empty
+        calcgraph::Batched<int> direct;
+        auto empty = direct.read();
+        CPPUNIT_ASSERT(empty->empty());
+        CPPUNIT_ASSERT(direct.read() == empty);
+
+        direct.store(1);
+        direct.store(2);
+        const std::vector<int> *first = direct.read().get();
+        CPPUNIT_ASSERT(*first == std::vector<int>({1, 2}));
+        direct.store(3);
+        auto second = direct.read();
+        CPPUNIT_ASSERT(second.get() == first);
+        CPPUNIT_ASSERT(*second == std::vector<int>({3}));
+
+        // still held, so can't be reused
+        direct.store(4);
+        CPPUNIT_ASSERT(direct.read().get() != first);
+        CPPUNIT_ASSERT(*second == std::vector<int>({3}));
+    }
+
     void testVariadic() {
         struct calcgraph::Stats stats;
         calcgraph::Graph g;
@@ -441,6 +1578,53 @@ class GraphTest final : public CppUnit::TestFixture {
         expected = intvector(new std::vector<int>({4}));
         CPPUNIT_ASSERT(std::equal(expected->begin(), expected->end(),
                                   res.read()->begin(), res.read()->end()));
+
+        // removing an input moves the last one into its place
+        auto three = var->variadic_add<0>(3);
+        auto four = var->variadic_add<0>(8);
+        var->variadic_remove<0>(two);
+        three.append(g, 1);
+        g(&stats);
+        expected = intvector(new std::vector<int>({8, 1}));
+        CPPUNIT_ASSERT(*res.read() == *expected);
+    }
+
+    void testIncremental() {
+        using changes = std::shared_ptr<const calcgraph::Changes<int>>;
+        struct calcgraph::Stats stats;
+        calcgraph::Graph g;
+        calcgraph::Latest<changes> res;
+
+        // setup
+        auto inc =
+            g.node().incremental<int>().connect([](changes c) { return c; });
+        auto one = inc->variadic_add<0>(1);
+        auto two = inc->variadic_add<0>(2);
+        auto three = inc->variadic_add<0>(3);
+        inc->connect(res);
+        g(&stats);
+        CPPUNIT_ASSERT(res.read()->values == std::vector<int>({1, 2, 3}));
+        CPPUNIT_ASSERT(res.read()->changed ==
+                       std::vector<std::size_t>({0, 1, 2}));
+
+        auto held = res.read();
+        three.append(g, 5);
+        one.append(g, 6);
+        three.append(g, 7);
+        g(&stats);
+        CPPUNIT_ASSERT_MESSAGE(stats, stats.worked == 1);
+        CPPUNIT_ASSERT(res.read()->values == std::vector<int>({6, 2, 7}));
+        CPPUNIT_ASSERT(res.read()->changed == std::vector<std::size_t>({0, 2}));
+
+        // the output we held on to wasn't updated in-place
+        CPPUNIT_ASSERT(held->values == std::vector<int>({1, 2, 3}));
+
+        // removing moves the last input
+        inc->variadic_remove<0>(one);
+        two.append(g, 4);
+        g(&stats);
+        CPPUNIT_ASSERT(res.read()->values == std::vector<int>({7, 4}));
+        CPPUNIT_ASSERT(res.read()->changed == std::vector<std::size_t>({0, 1}));
     }
 
     void testDemultiplexed() {
@@ -503,6 +1687,45 @@ class GraphTest final : public CppUnit::TestFixture {
         CPPUNIT_ASSERT(two.read() == 9); // *not* 4
     }
 
+    void testKeyIndices() {
+        calcgraph::Graph g;
+        calcgraph::Latest<p_intpair> res;
+
+        // a FlatIndex has to grow (without moving the keyed outputs)
+        auto flat = g.node()
+                        .output<calcgraph::Demultiplexed>()
+                        .latest(calcgraph::unconnected<p_intpair>())
+                        .connect([](p_intpair a) { return *a; });
+        std::deque<calcgraph::Latest<int>> outputs(1000);
+        for (int k = 0; k < 1000; ++k) {
+            flat->keyed_output(k * 1024).connect(outputs[k]);
+        }
+        for (int k = 0; k < 1000; k += 7) {
+            flat->input<0>().append(g, p_intpair(new intpair(k * 1024, k)));
+            g();
+            CPPUNIT_ASSERT(outputs[k].read() == k);
+        }
+
+        // a DenseIndex with small integer keys
+        using by_byte = std::pair<uint8_t, int>;
+        auto dense =
+            g.node()
+                .output<calcgraph::DemultiplexedBy<calcgraph::DenseIndex>::type>()
+                .latest(calcgraph::unconnected<std::shared_ptr<by_byte>>())
+                .connect([](std::shared_ptr<by_byte> a) { return *a; });
+        calcgraph::Latest<int> three;
+        calcgraph::Latest<std::shared_ptr<by_byte>> unkeyed;
+        dense->keyed_output(3).connect(three);
+        dense->connect(unkeyed);
+
+        dense->input<0>().append(g, std::make_shared<by_byte>(3, 4));
+        g();
+        CPPUNIT_ASSERT(three.read() == 4);
+        dense->input<0>().append(g, std::make_shared<by_byte>(200, 5));
+        g();
+        CPPUNIT_ASSERT(*unkeyed.read() == by_byte(200, 5));
+    }
+
     void testMultiValued() {
         struct calcgraph::Stats stats;
         calcgraph::Graph g;
@@ -577,6 +1800,238 @@ class GraphTest final : public CppUnit::TestFixture {
         res.exchange(d);
     }
 
+    void testEpoch() {
+        // reading an intrusive_ptr adds a reference for the reader
+        boost::intrusive_ptr<RefCounted> a(new RefCounted{});
+        {
+            calcgraph::Latest<boost::intrusive_ptr<RefCounted>> res(a);
+            CPPUNIT_ASSERT(a->refcount == 2);
+            res.read();
+            res.read();
+            CPPUNIT_ASSERT(res.read() == a);
+            CPPUNIT_ASSERT(a->refcount == 2);
+        }
+        CPPUNIT_ASSERT(a->refcount == 1);
+
+        // replaced values are only destroyed once it's safe
+        std::atomic<int> destroyed(0);
+        auto counted = [&destroyed](int v) {
+            return std::shared_ptr<int>(new int(v), [&destroyed](int *p) {
+                destroyed++;
+                delete p;
+            });
+        };
+        {
+            calcgraph::Latest<std::shared_ptr<int>> res(counted(1));
+            res.store(counted(2));
+            for (int i = 0; i < 4; ++i)
+                calcgraph::Epoch::shared().collect();
+            CPPUNIT_ASSERT(destroyed.load() == 1);
+
+            calcgraph::Epoch::shared().pin();
+            CPPUNIT_ASSERT(*res.borrow() == 2);
+            res.store(counted(3));
+            for (int i = 0; i < 4; ++i)
+                calcgraph::Epoch::shared().collect();
+            CPPUNIT_ASSERT(destroyed.load() == 1); // 2's still pinned
+            calcgraph::Epoch::shared().unpin();
+            for (int i = 0; i < 4; ++i)
+                calcgraph::Epoch::shared().collect();
+            CPPUNIT_ASSERT(destroyed.load() == 2);
+            CPPUNIT_ASSERT(*res.read() == 3);
+        }
+        CPPUNIT_ASSERT(destroyed.load() == 3);
+
+        // readers racing with writers
+        calcgraph::Latest<std::shared_ptr<int>> shared(std::make_shared<int>(0));
+        std::atomic<bool> stop(false);
+        std::thread writer([&shared, &stop]() {
+            for (int i = 1; !stop.load(); ++i)
+                shared.store(std::make_shared<int>(i));
+        });
+        int last = 0;
+        for (int i = 0; i < 100000; ++i) {
+            int seen = *shared.read();
+            CPPUNIT_ASSERT(seen >= last);
+            last = seen;
+        }
+        stop.store(true);
+        writer.join();
+    }
+
+    void testGraphEpoch() {
+        std::atomic<int> destroyed(0);
+        auto counted = [&destroyed](int v) {
+            return std::shared_ptr<int>(new int(v), [&destroyed](int *p) {
+                destroyed++;
+                delete p;
+            });
+        };
+        {
+            calcgraph::Graph g;
+            calcgraph::Latest<int> res;
+
+            // functions taking a const reference share the input's own copy
+            long uses = 0;
+            auto node =
+                g.node()
+                    .latest(calcgraph::unconnected<std::shared_ptr<int>>(),
+                            counted(1))
+                    .connect([&uses](const std::shared_ptr<int> &p) {
+                        uses = p.use_count();
+                        return *p;
+                    });
+            node->connect(res);
+            g();
+            CPPUNIT_ASSERT(res.read() == 1);
+            CPPUNIT_ASSERT(uses == 1);
+
+            // replaced inputs are destroyed by the Graph's own ticks
+            node->input<0>().append(g, counted(2));
+            g();
+            CPPUNIT_ASSERT(res.read() == 2);
+            CPPUNIT_ASSERT(uses == 1);
+            for (int i = 0; i < 4; ++i)
+                g();
+            CPPUNIT_ASSERT(destroyed.load() == 1);
+        }
+        CPPUNIT_ASSERT(destroyed.load() == 2);
+    }
+
+    struct Quote {
+        double bid, ask;
+        int64_t size, timestamp;
+    };
+
+    struct Level {
+        double price;
+        int64_t depth;
+        Level(double price, int64_t depth) : price(price), depth(depth) {}
+    };
+
+    void testSeqLock() {
+        static_assert(calcgraph::use_seqlock<Quote>::value, "not seqlocked");
+        static_assert(!calcgraph::use_seqlock<int>::value, "seqlocked");
+        calcgraph::Graph g;
+        calcgraph::Latest<double> res;
+
+        // setup
+        auto node = g.node()
+                        .latest(calcgraph::unconnected<Quote>(),
+                                Quote{1.0, 2.0, 3, 4})
+                        .connect([](Quote q) { return q.ask - q.bid; });
+        node->connect(res);
+        g();
+        CPPUNIT_ASSERT(res.read() == 1.0);
+
+        node->input<0>().append(g, Quote{1.0, 4.0, 3, 5});
+        g();
+        CPPUNIT_ASSERT(res.read() == 3.0);
+
+        // readers racing with writers never see a torn value
+        calcgraph::Latest<Quote> shared(Quote{0.0, 0.0, 0, 0});
+        std::atomic<bool> stop(false);
+        std::thread writer([&shared, &stop]() {
+            for (int64_t i = 1; !stop.load(); ++i)
+                shared.store(Quote{double(i), double(i), i, i});
+        });
+        for (int i = 0; i < 100000; ++i) {
+            Quote q = shared.read();
+            CPPUNIT_ASSERT(q.bid == q.ask && q.size == q.timestamp &&
+                           q.bid == double(q.size));
+        }
+        stop.store(true);
+        writer.join();
+        int64_t last = shared.read().size;
+        CPPUNIT_ASSERT(shared.exchange(Quote{}).size == last);
+        CPPUNIT_ASSERT(shared.read().size == 0);
+
+        // values don't need a default constructor
+        calcgraph::Latest<Level> level(Level(1.5, 2));
+        CPPUNIT_ASSERT(level.read().price == 1.5);
+        CPPUNIT_ASSERT(level.exchange(Level(2.5, 3)).depth == 2);
+        CPPUNIT_ASSERT(level.read().depth == 3);
+    }
+
+    void testBorrowed() {
+        calcgraph::Graph g;
+        calcgraph::Latest<int> res;
+
+        // setup
+        auto node = g.node()
+                        .borrowed(calcgraph::unconnected<p_intpair>())
+                        .connect([](const intpair *p) {
+                            return p ? p->first + p->second : -1;
+                        });
+        node->connect(res);
+        g();
+        CPPUNIT_ASSERT(res.read() == -1);
+
+        node->input<0>().append(g, std::make_shared<intpair>(1, 2));
+        g();
+        CPPUNIT_ASSERT(res.read() == 3);
+    }
+
+    /**
+     * @brief Nodes built one after the other should be next to each other in
+     * memory
+     */
+    void testArena() {
+        calcgraph::Graph g;
+        auto a = g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto b = g.node().connect(int_identity, a.get());
+        auto distance = reinterpret_cast<std::uintptr_t>(b.get()) -
+                        reinterpret_cast<std::uintptr_t>(a.get());
+        CPPUNIT_ASSERT(distance < 1024);
+
+        // check PoolAllocator works with std::allocate_shared
+        std::shared_ptr<int> first =
+            std::allocate_shared<int>(calcgraph::PoolAllocator<int>(), 1);
+        first.reset();
+        std::shared_ptr<int> second =
+            std::allocate_shared<int>(calcgraph::PoolAllocator<int>(), 2);
+        CPPUNIT_ASSERT(*second == 2);
+    }
+
+#ifdef CALCGRAPH_METRICS
+    void testMetrics() {
+        calcgraph::Graph g;
+
+        // setup
+        auto in = g.node().connect(int_identity, calcgraph::unconnected<int>());
+        auto out = g.node().connect(
+            [](int a) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return a;
+            },
+            in.get());
+        g();
+        in->input<0>().append(g, 3);
+        g();
+
+        auto metrics = g.metrics();
+        CPPUNIT_ASSERT(metrics.size() == 2);
+        auto node = std::find_if(
+            metrics.begin(), metrics.end(),
+            [&out](calcgraph::NodeMetrics &m) { return m.id == out->id; });
+        CPPUNIT_ASSERT(node != metrics.end());
+        CPPUNIT_ASSERT_MESSAGE(*node, node->evaluations == 2);
+        CPPUNIT_ASSERT_MESSAGE(*node, node->fn_nanos >= 2000000);
+        CPPUNIT_ASSERT_MESSAGE(*node, node->max_fn_nanos >= 1000000);
+        CPPUNIT_ASSERT_MESSAGE(*node, node->max_fn_nanos <= node->fn_nanos);
+        CPPUNIT_ASSERT_MESSAGE(*node, node->contended == 0);
+
+        // destroyed Nodes are dropped
+        {
+            auto temp =
+                g.node().connect(int_identity, calcgraph::unconnected<int>());
+            CPPUNIT_ASSERT(g.metrics().size() == 3);
+            g();
+        }
+        CPPUNIT_ASSERT(g.metrics().size() == 2);
+    }
+#endif
+
     void testEmbedSingle() {
         struct calcgraph::Stats stats;
         calcgraph::Graph g;
@@ -649,14 +2104,49 @@ class GraphTest final : public CppUnit::TestFixture {
     CPPUNIT_TEST(testConstant);
     CPPUNIT_TEST(testChain);
     CPPUNIT_TEST(testPropagationPolicies);
+    CPPUNIT_TEST(testRedundant);
+    CPPUNIT_TEST(testFullStats);
     CPPUNIT_TEST(testSharedPointer);
     CPPUNIT_TEST(testDisconnect);
     CPPUNIT_TEST(testThreaded);
+    CPPUNIT_TEST(testParking);
+    CPPUNIT_TEST(testParallel);
+    CPPUNIT_TEST(testParallelDiamond);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testFanOut);
+    CPPUNIT_TEST(testLazy);
+    CPPUNIT_TEST(testThrottle);
+    CPPUNIT_TEST(testPriority);
+    CPPUNIT_TEST(testCompact);
+    CPPUNIT_TEST(testCompactUnreachedUpstream);
+    CPPUNIT_TEST(testCompactWeakCycle);
+    CPPUNIT_TEST(testPipe);
+    CPPUNIT_TEST(testReductions);
+    CPPUNIT_TEST(testOnChangeVector);
+#ifdef __linux__
+    CPPUNIT_TEST(testRecordReplay);
+    CPPUNIT_TEST(testCheckpoint);
+#endif
+    CPPUNIT_TEST(testTolerance);
+    CPPUNIT_TEST(testPinned);
+    CPPUNIT_TEST(testChannel);
+    CPPUNIT_TEST(testEpoch);
+    CPPUNIT_TEST(testGraphEpoch);
+    CPPUNIT_TEST(testBorrowed);
+    CPPUNIT_TEST(testSeqLock);
     CPPUNIT_TEST(testAccumulator);
+    CPPUNIT_TEST(testRing);
+    CPPUNIT_TEST(testBatched);
     CPPUNIT_TEST(testVariadic);
+    CPPUNIT_TEST(testIncremental);
     CPPUNIT_TEST(testDemultiplexed);
+    CPPUNIT_TEST(testKeyIndices);
     CPPUNIT_TEST(testMultiValued);
     CPPUNIT_TEST(testMemoryLeakWorkQueue);
+    CPPUNIT_TEST(testArena);
+#ifdef CALCGRAPH_METRICS
+    CPPUNIT_TEST(testMetrics);
+#endif
     CPPUNIT_TEST(testEmbedSingle);
     CPPUNIT_TEST(testEmbedMulti);
     CPPUNIT_TEST(testMemoryLeakLatestIntrusive);